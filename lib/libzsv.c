@@ -18,6 +18,9 @@ DM20-0619
 #include <sys/shm.h>
 #include <sys/wait.h>
 #include <sys/ipc.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <errno.h>
 #include <sys/shm.h>
 #include <stdlib.h>
 #include <string.h>
@@ -242,6 +245,7 @@ int zsv_is_admissible(struct reserve_spec_t *reserves_specs_table, int tablesize
     rtable[i].exectime_in_rm_ns=0;
     rtable[i].pid=0;
     rtable[i].criticality=reserves_specs_table[dec_crit_indices[i]].criticality;
+    rtable[i].timer_slack_ns=reserves_specs_table[dec_crit_indices[i]].timer_slack_nsec;
   }
 
   // try admission
@@ -277,6 +281,29 @@ int zsv_create_reserve(int schedfd, long period_sec, long period_nsec,
 		       long exec_sec, long exec_nsec,
 		       long nominal_exec_sec, long nominal_exec_nsec,
 		       int priority, int criticality)
+{
+  return zsv_create_reserve_with_slack(schedfd, period_sec, period_nsec,
+				       zsinstant_sec, zsinstant_nsec,
+				       hyp_enforcer_sec, hyp_enforcer_nsec,
+				       exec_sec, exec_nsec,
+				       nominal_exec_sec, nominal_exec_nsec,
+				       priority, criticality, 0L);
+}
+
+/*
+ * Same as zsv_create_reserve() but allowing the period and zero-slack
+ * timers of the reserve to expire up to timer_slack_nsec late so the
+ * kernel can coalesce them with other timers. The slack is accounted as
+ * release jitter: the zero-slack instant is armed timer_slack_nsec
+ * early and the admission test adds it to the response times.
+ */
+int zsv_create_reserve_with_slack(int schedfd, long period_sec, long period_nsec,
+				  long zsinstant_sec, long zsinstant_nsec,
+				  long hyp_enforcer_sec, long hyp_enforcer_nsec,
+				  long exec_sec, long exec_nsec,
+				  long nominal_exec_sec, long nominal_exec_nsec,
+				  int priority, int criticality,
+				  long timer_slack_nsec)
 {
   struct api_call call;
   int ret;
@@ -294,6 +321,7 @@ int zsv_create_reserve(int schedfd, long period_sec, long period_nsec,
   call.nominal_exec_nsec = nominal_exec_nsec;
   call.priority=priority; // larger number = higher priority
   call.criticality = criticality; // larger number = higher criticality
+  call.timer_slack_nsec = timer_slack_nsec;
   ret = write(schedfd, &call, sizeof(call));
   return ret;
 }
@@ -340,6 +368,29 @@ int zsv_get_trace_size(int schedfd)
   return ret;
 }
 
+int zsv_set_trace_watermark(int schedfd, int records)
+{
+  struct api_call call;
+  int ret;
+
+  call.cmd = SET_TRACE_WATERMARK;
+  call.rid = records;
+  ret = write(schedfd, &call, sizeof(call));
+  return ret;
+}
+
+int zsv_set_trace_filter(int schedfd, struct zsv_trace_filter *filter)
+{
+  struct api_call call;
+  int ret;
+
+  call.cmd = SET_TRACE_FILTER;
+  call.buffer = filter;
+  call.buf_len = sizeof(struct zsv_trace_filter);
+  ret = write(schedfd, &call, sizeof(call));
+  return ret;
+}
+
 int zsv_get_acet_ns(int schedfd, int rid, unsigned long long *pacet)
 {
   struct api_call call;
@@ -548,13 +599,115 @@ int zsv_stop_enforcement_handler(int rid)
   return 0;
 }
 
+/*
+ * Import the events logged by the hypervisor into the kernel trace
+ * rings so they become visible through the trace mapping.
+ */
+int zsv_trace_sync(int schedfd)
+{
+  char dummy;
+  return read(schedfd, &dummy, 0);
+}
+
+/*
+ * Map the trace rings of the scheduler. The control page is mapped
+ * first to learn the size of the whole mapping.
+ */
+int zsv_trace_map(int schedfd, struct zsv_trace_map *map)
+{
+  long pagesize = sysconf(_SC_PAGESIZE);
+  struct zsv_trace_ctl *ctl;
+  unsigned int map_size;
+
+  ctl = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, schedfd, 0);
+  if (ctl == MAP_FAILED){
+    printf("zsv_trace_map(): could not map the trace control page\n");
+    return -1;
+  }
+
+  if (ctl->version != ZSV_TRACE_VERSION || ctl->rec_size != sizeof(struct trace_rec_t)){
+    printf("zsv_trace_map(): trace version %u record size %u not supported\n", ctl->version, ctl->rec_size);
+    munmap(ctl, pagesize);
+    return -1;
+  }
+  map_size = ctl->map_size;
+  munmap(ctl, pagesize);
+
+  map->base = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, schedfd, 0);
+  if (map->base == MAP_FAILED){
+    printf("zsv_trace_map(): could not map %u bytes of trace\n", map_size);
+    return -1;
+  }
+  map->ctl = (struct zsv_trace_ctl *) map->base;
+  return 0;
+}
+
+int zsv_trace_unmap(struct zsv_trace_map *map)
+{
+  return munmap(map->base, map->ctl->map_size);
+}
+
+/*
+ * Return a pointer (into the mapping) to the oldest record of the ring
+ * of cpu and its counter in idx, or NULL if the ring is empty. The
+ * record is only valid if zsv_trace_consume(map, cpu, *idx) succeeds
+ * after the caller is done with it: the kernel may overwrite it
+ * in the meantime.
+ */
+struct trace_rec_t *zsv_trace_peek(struct zsv_trace_map *map, int cpu, unsigned int *idx)
+{
+  struct zsv_trace_ring_ctl *rctl = &map->ctl->ring[cpu];
+  struct trace_rec_t *recs = (struct trace_rec_t *)((char *)map->base + rctl->offset);
+  unsigned int tail = __atomic_load_n(&rctl->tail, __ATOMIC_ACQUIRE);
+
+  if (tail == __atomic_load_n(&rctl->head, __ATOMIC_ACQUIRE))
+    return NULL;
+
+  *idx = tail;
+  return &recs[tail & (rctl->size - 1)];
+}
+
+/*
+ * Release the record peeked with counter idx. Returns 0 if the kernel
+ * overwrote it before it was released (the record must be discarded).
+ */
+int zsv_trace_consume(struct zsv_trace_map *map, int cpu, unsigned int idx)
+{
+  struct zsv_trace_ring_ctl *rctl = &map->ctl->ring[cpu];
+  unsigned int expected = idx;
+
+  return __atomic_compare_exchange_n(&rctl->tail, &expected, idx+1, 0,
+				     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
 int zsv_write_trace(int schedfd, FILE *fid)
 {
+  struct zsv_trace_map map;
   struct trace_rec_t *tracep;
-  int size = zsv_get_trace_size(schedfd);
+  struct trace_rec_t rec;
+  unsigned int idx;
+  int size;
   int traces_read=0;
-  int i;
+  int cpu, i;
+
+  zsv_trace_sync(schedfd);
+
+  if (zsv_trace_map(schedfd, &map) == 0){
+    for (cpu=0; cpu < map.ctl->num_cpus; cpu++){
+      while ((tracep = zsv_trace_peek(&map, cpu, &idx)) != NULL){
+	rec = *tracep;
+	if (zsv_trace_consume(&map, cpu, idx)){
+	  fprintf(fid,"%d %llu %d\n",rec.rid, rec.timestamp_ns, rec.event_type);
+	  traces_read++;
+	}
+      }
+    }
+    zsv_trace_unmap(&map);
+    return traces_read;
+  }
 
+  // no mmap support: copy the trace with read()
+  size = zsv_get_trace_size(schedfd);
   if (size >0){
     tracep = malloc(sizeof(struct trace_rec_t)*size);
     if (tracep == NULL){
@@ -562,16 +715,606 @@ int zsv_write_trace(int schedfd, FILE *fid)
       return -1;
     }
 
-    traces_read = read(schedfd,tracep,size);
+    traces_read = read(schedfd,tracep,sizeof(struct trace_rec_t)*size) / (int) sizeof(struct trace_rec_t);
 
-    if (traces_read>0){
-      for (i=0;i<traces_read;i++){
-	fprintf(fid,"%d %llu %d\n",tracep[i].rid, tracep[i].timestamp_ns, tracep[i].event_type);
-      }
+    for (i=0;i<traces_read;i++){
+      fprintf(fid,"%d %llu %d\n",tracep[i].rid, tracep[i].timestamp_ns, tracep[i].event_type);
     }
-    
+
     free(tracep);
   }
+  return traces_read;
+}
+
+/*
+ * Compact binary trace format (see ZSV_TRACE_FILE_MAGIC in zsrmvapi.h)
+ */
+static int put_varint(unsigned char *buf, unsigned long long v)
+{
+  int n=0;
+
+  while (v >= 0x80){
+    buf[n++] = (unsigned char)(v | 0x80);
+    v >>= 7;
+  }
+  buf[n++] = (unsigned char) v;
+  return n;
+}
+
+static unsigned long long zigzag(long long v)
+{
+  return ((unsigned long long) v << 1) ^ (unsigned long long)(v >> 63);
+}
+
+static long long unzigzag(unsigned long long v)
+{
+  return (long long)(v >> 1) ^ -(long long)(v & 1);
+}
+
+static int put_le(unsigned char *buf, unsigned long long v, int bytes)
+{
+  int i;
+
+  for (i=0;i<bytes;i++){
+    buf[i] = (unsigned char)(v >> (8*i));
+  }
+  return bytes;
+}
+
+/*
+ * Encode n records of cpu as one block into buf, which must hold
+ * ZSV_TRACE_BLOCK_BYTES(n) bytes. Returns the number of bytes used.
+ */
+int zsv_trace_encode_block(int cpu, struct trace_rec_t *recs, int n, unsigned char *buf)
+{
+  unsigned long long last;
+  unsigned long long packed;
+  int len=0;
+  int i;
+
+  if (n <= 0)
+    return 0;
+
+  last = recs[0].timestamp_ns;
+  // the block length is filled in at the end
+  len += ZSV_TRACE_BLOCK_HEADER_BYTES;
+  len += put_varint(buf+len, cpu);
+  len += put_varint(buf+len, n);
+  len += put_le(buf+len, last, 8);
+
+  for (i=0;i<n;i++){
+    // hypervisor records are imported late so deltas can be negative
+    len += put_varint(buf+len, zigzag((long long)(recs[i].timestamp_ns - last)));
+    last = recs[i].timestamp_ns;
+    if (recs[i].event_type >= 0 && recs[i].event_type < ZSV_TRACE_EVENT_ESCAPE){
+      packed = (zigzag(recs[i].rid) << ZSV_TRACE_EVENT_BITS) | recs[i].event_type;
+      len += put_varint(buf+len, packed);
+    } else {
+      packed = (zigzag(recs[i].rid) << ZSV_TRACE_EVENT_BITS) | ZSV_TRACE_EVENT_ESCAPE;
+      len += put_varint(buf+len, packed);
+      len += put_varint(buf+len, zigzag((long long)recs[i].event_type - ZSV_TRACE_EVENT_ESCAPE));
+    }
+  }
+  put_le(buf, len - ZSV_TRACE_BLOCK_HEADER_BYTES, ZSV_TRACE_BLOCK_HEADER_BYTES);
+  return len;
+}
+
+static int flush_trace_block(FILE *fid, int cpu, struct trace_rec_t *recs, int n, unsigned char *buf)
+{
+  int len = zsv_trace_encode_block(cpu, recs, n, buf);
+
+  if (len > 0 && fwrite(buf, 1, len, fid) != len)
+    return -1;
+  return 0;
+}
+
+/*
+ * Consume the trace of the scheduler writing it to fid in the binary
+ * format. Returns the number of records written or -1 on error.
+ */
+int zsv_write_trace_binary(int schedfd, FILE *fid)
+{
+  struct zsv_trace_map map;
+  struct trace_rec_t *recs;
+  struct trace_rec_t *tracep;
+  unsigned char *buf;
+  unsigned char header[8];
+  unsigned int idx;
+  int n, cpu, ret=0;
+  int traces_written=0;
+
+  recs = malloc(sizeof(struct trace_rec_t) * ZSV_TRACE_BLOCK_RECORDS);
+  buf = malloc(ZSV_TRACE_BLOCK_BYTES(ZSV_TRACE_BLOCK_RECORDS));
+  if (recs == NULL || buf == NULL){
+    printf("zsv_write_trace_binary(): could not allocate memory\n");
+    free(recs);
+    free(buf);
+    return -1;
+  }
+
+  zsv_trace_sync(schedfd);
+
+  if (zsv_trace_map(schedfd, &map) < 0){
+    free(recs);
+    free(buf);
+    return -1;
+  }
+
+  put_le(header, ZSV_TRACE_FILE_MAGIC, 4);
+  put_le(header+4, ZSV_TRACE_FILE_VERSION, 4);
+  if (fwrite(header, 1, sizeof(header), fid) != sizeof(header))
+    ret = -1;
+
+  for (cpu=0; ret == 0 && cpu < map.ctl->num_cpus; cpu++){
+    n = 0;
+    while ((tracep = zsv_trace_peek(&map, cpu, &idx)) != NULL){
+      recs[n] = *tracep;
+      if (!zsv_trace_consume(&map, cpu, idx))
+	continue;
+      if (++n == ZSV_TRACE_BLOCK_RECORDS){
+	if ((ret = flush_trace_block(fid, cpu, recs, n, buf)) < 0)
+	  break;
+	traces_written += n;
+	n = 0;
+      }
+    }
+    if (ret == 0 && (ret = flush_trace_block(fid, cpu, recs, n, buf)) == 0)
+      traces_written += n;
+  }
+
+  zsv_trace_unmap(&map);
+  free(recs);
+  free(buf);
+
+  if (ret < 0){
+    printf("zsv_write_trace_binary(): error writing trace file\n");
+    return -1;
+  }
+  return traces_written;
+}
+
+// returns 0 at the end of the file, -1 on truncated varints
+static int get_varint(FILE *fid, unsigned long long *v)
+{
+  int c, shift=0;
+
+  *v = 0;
+  while ((c = getc(fid)) != EOF){
+    *v |= (unsigned long long)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      return 1;
+    shift += 7;
+    if (shift >= 64)
+      return -1;
+  }
+  return shift == 0 ? 0 : -1;
+}
+
+static int get_le(FILE *fid, unsigned long long *v, int bytes)
+{
+  int c, i;
+
+  *v = 0;
+  for (i=0;i<bytes;i++){
+    if ((c = getc(fid)) == EOF)
+      return -1;
+    *v |= (unsigned long long) c << (8*i);
+  }
+  return 1;
+}
+
+/*
+ * Prepare dec to decode the binary trace file fid. Returns -1 if fid
+ * is not a binary trace.
+ */
+int zsv_trace_decoder_open(struct zsv_trace_decoder *dec, FILE *fid)
+{
+  unsigned long long magic, version;
+
+  memset(dec, 0, sizeof(*dec));
+  dec->fid = fid;
+
+  if (get_le(fid, &magic, 4) < 0 || get_le(fid, &version, 4) < 0 ||
+      magic != ZSV_TRACE_FILE_MAGIC || version < 1 || version > ZSV_TRACE_FILE_VERSION)
+    return -1;
+  dec->version = (int) version;
+  return 0;
+}
+
+/*
+ * Prepare dec to decode the blocks of a binary trace of the given
+ * version that follow the current position of fid, which must be at a
+ * block boundary (e.g. a range of blocks split off a larger trace to
+ * be decoded in parallel).
+ */
+int zsv_trace_decoder_open_block(struct zsv_trace_decoder *dec, FILE *fid, int version)
+{
+  memset(dec, 0, sizeof(*dec));
+  dec->fid = fid;
+  dec->version = version;
+  return 0;
+}
+
+/*
+ * Decode the next record. Returns 1 with the record in rec and its CPU
+ * in cpu (if not NULL), 0 at the end of the trace or -1 if the file is
+ * corrupted.
+ */
+int zsv_trace_decode_next(struct zsv_trace_decoder *dec, struct trace_rec_t *rec, int *cpu)
+{
+  unsigned long long v, packed;
+  int ret;
+
+  while (dec->remaining == 0){
+    if (dec->version >= 2){
+      // the block length is only needed to seek between blocks
+      if ((ret = getc(dec->fid)) == EOF)
+	return 0;
+      if (get_le(dec->fid, &v, ZSV_TRACE_BLOCK_HEADER_BYTES - 1) < 0)
+	return -1;
+      if ((ret = get_varint(dec->fid, &v)) <= 0)
+	return -1;
+    } else if ((ret = get_varint(dec->fid, &v)) <= 0)
+      return ret;
+    dec->cpu = (int) v;
+    if (get_varint(dec->fid, &v) <= 0)
+      return -1;
+    dec->remaining = v;
+    if (get_le(dec->fid, &dec->last_timestamp, 8) < 0)
+      return -1;
+  }
+
+  if (get_varint(dec->fid, &v) <= 0 || get_varint(dec->fid, &packed) <= 0)
+    return -1;
+
+  dec->last_timestamp += (unsigned long long) unzigzag(v);
+  rec->timestamp_ns = dec->last_timestamp;
+  rec->rid = (int) unzigzag(packed >> ZSV_TRACE_EVENT_BITS);
+  rec->event_type = (int)(packed & ZSV_TRACE_EVENT_ESCAPE);
+  if (rec->event_type == ZSV_TRACE_EVENT_ESCAPE){
+    if (get_varint(dec->fid, &v) <= 0)
+      return -1;
+    rec->event_type = (int)(unzigzag(v) + ZSV_TRACE_EVENT_ESCAPE);
+  }
+  dec->remaining--;
+
+  if (cpu != NULL)
+    *cpu = dec->cpu;
+  return 1;
+}
+
+/*
+ * Sort n records by timestamp. The trace is written one CPU after
+ * another so it is only in time order within each CPU, while the events
+ * of a reserve come from several CPUs (a release from the CPU of its
+ * timer, the completion from CPU0): readers that follow a reserve sort
+ * its records first. The sort is stable (records with the same
+ * timestamp keep their order). Returns -1 if out of memory.
+ */
+int zsv_trace_sort(struct trace_rec_t *recs, long n)
+{
+  struct trace_rec_t *tmp, *src, *dst, *t;
+  long width, lo, mid, hi, i, j, k;
+
+  if (n < 2)
+    return 0;
+  if ((tmp = malloc(n * sizeof(struct trace_rec_t))) == NULL)
+    return -1;
+
+  // bottom-up merge sort
+  src = recs;
+  dst = tmp;
+  for (width=1; width < n; width *= 2){
+    for (lo=0; lo < n; lo += 2*width){
+      mid = (lo + width < n) ? lo + width : n;
+      hi = (lo + 2*width < n) ? lo + 2*width : n;
+      i = lo;
+      j = mid;
+      k = lo;
+      while (i < mid && j < hi)
+	dst[k++] = (src[j].timestamp_ns < src[i].timestamp_ns) ? src[j++] : src[i++];
+      while (i < mid)
+	dst[k++] = src[i++];
+      while (j < hi)
+	dst[k++] = src[j++];
+    }
+    t = src;
+    src = dst;
+    dst = t;
+  }
+  if (src != recs)
+    memcpy(recs, src, n * sizeof(struct trace_rec_t));
+  free(tmp);
+  return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  ssize_t n;
+
+  while (len > 0){
+    n = write(fd, p, len);
+    if (n < 0)
+      return -1;
+    p += n;
+    len -= n;
+  }
+  return 0;
+}
+
+/*
+ * Move everything in the trace rings to the output of stream using
+ * buffers of one block (ZSV_TRACE_BLOCK_RECORDS records).
+ */
+static void trace_stream_drain(struct zsv_trace_stream *stream, struct zsv_trace_map *map,
+			       struct trace_rec_t *recs, char *buf)
+{
+  struct trace_rec_t *tracep;
+  unsigned int idx;
+  int cpu, n, i, len;
+
+  for (cpu=0; cpu < map->ctl->num_cpus; cpu++){
+    do {
+      n = 0;
+      while (n < ZSV_TRACE_BLOCK_RECORDS && (tracep = zsv_trace_peek(map, cpu, &idx)) != NULL){
+	recs[n] = *tracep;
+	if (zsv_trace_consume(map, cpu, idx))
+	  n++;
+      }
+      if (n == 0)
+	break;
+
+      if (stream->binary){
+	len = zsv_trace_encode_block(cpu, recs, n, (unsigned char *)buf);
+      } else {
+	len = 0;
+	for (i=0;i<n;i++){
+	  len += sprintf(buf+len,"%d %llu %d\n",recs[i].rid, recs[i].timestamp_ns, recs[i].event_type);
+	}
+      }
+      if (write_all(stream->outfd, buf, len) < 0)
+	stream->errors++;
+      else
+	stream->records += n;
+    } while (n == ZSV_TRACE_BLOCK_RECORDS);
+  }
+}
+
+static void *trace_stream_thread(void *arg)
+{
+  struct zsv_trace_stream *stream = arg;
+  struct zsv_trace_map map;
+  struct trace_rec_t *recs;
+  struct pollfd pfd;
+  char *buf;
+
+  recs = malloc(sizeof(struct trace_rec_t) * ZSV_TRACE_BLOCK_RECORDS);
+  // large enough for a binary block or a block of text lines
+  buf = malloc(ZSV_TRACE_BLOCK_BYTES(ZSV_TRACE_BLOCK_RECORDS) + 64 * ZSV_TRACE_BLOCK_RECORDS);
+  if (recs == NULL || buf == NULL || zsv_trace_map(stream->schedfd, &map) < 0){
+    printf("zsv_trace_stream(): could not set up the trace stream\n");
+    free(recs);
+    free(buf);
+    stream->errors++;
+    return NULL;
+  }
+
+  pfd.fd = stream->schedfd;
+  pfd.events = POLLIN;
+
+  while (atomic_load(&stream->running)){
+    if (poll(&pfd, 1, ZSV_TRACE_STREAM_TIMEOUT_MS) < 0 && errno != EINTR){
+      stream->errors++;
+      break;
+    }
+    zsv_trace_sync(stream->schedfd);
+    trace_stream_drain(stream, &map, recs, buf);
+  }
+
+  // last events before the stop
+  zsv_trace_sync(stream->schedfd);
+  trace_stream_drain(stream, &map, recs, buf);
+
+  zsv_trace_unmap(&map);
+  free(recs);
+  free(buf);
+  return NULL;
+}
+
+/*
+ * Start a thread that drains the trace into outfd (in the binary
+ * format if binary is set) whenever it holds watermark records.
+ */
+int zsv_trace_stream(struct zsv_trace_stream *stream, int schedfd, int outfd, int binary, int watermark)
+{
+  unsigned char header[8];
+
+  memset(stream, 0, sizeof(*stream));
+  stream->schedfd = schedfd;
+  stream->outfd = outfd;
+  stream->binary = binary;
+  atomic_store(&stream->running, 1);
+
+  if (watermark > 0 && zsv_set_trace_watermark(schedfd, watermark) < 0){
+    printf("zsv_trace_stream(): invalid watermark %d\n", watermark);
+    return -1;
+  }
+
+  if (binary){
+    put_le(header, ZSV_TRACE_FILE_MAGIC, 4);
+    put_le(header+4, ZSV_TRACE_FILE_VERSION, 4);
+    if (write_all(outfd, header, sizeof(header)) < 0)
+      return -1;
+  }
+
+  if (pthread_create(&stream->thread, NULL, trace_stream_thread, stream) != 0){
+    printf("zsv_trace_stream(): could not create thread\n");
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Stop the stream after a last drain. Returns the number of records
+ * written or -1 if any write failed.
+ */
+int zsv_trace_stream_stop(struct zsv_trace_stream *stream)
+{
+  atomic_store(&stream->running, 0);
+  pthread_join(stream->thread, NULL);
+  return stream->errors ? -1 : stream->records;
+}
+
+/*
+ * Chrome trace-event export (see struct zsv_chrome_export)
+ */
+#define CHROME_GUEST_PID 1
+#define CHROME_HYP_PID 2
+
+static void chrome_event(struct zsv_chrome_export *exp, const char *ph, const char *name,
+			 int pid, int tid, unsigned long long ts, const char *args)
+{
+  fprintf(exp->out, "%s\n{\"ph\":\"%s\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f%s%s%s}",
+	  exp->events ? "," : "", ph, name, pid, tid, ts / exp->ticks_per_us,
+	  (ph[0] == 'i' ? ",\"s\":\"t\"" : ""),
+	  (args ? ",\"args\":" : ""), (args ? args : ""));
+  exp->events++;
+}
+
+static void chrome_track_name(struct zsv_chrome_export *exp, int pid, int tid, const char *kind)
+{
+  fprintf(exp->out, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s %d\"}}",
+	  exp->events ? "," : "", pid, tid, kind, tid);
+  exp->events++;
+}
+
+int zsv_chrome_export_begin(struct zsv_chrome_export *exp, FILE *out, long long ticks_per_sec)
+{
+  memset(exp, 0, sizeof(*exp));
+  exp->out = out;
+  exp->ticks_per_us = ticks_per_sec / 1000000.0;
+
+  fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+  fprintf(out, "\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"guest reserves\"}}", CHROME_GUEST_PID);
+  fprintf(out, ",\n{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"args\":{\"name\":\"hypervisor hyptasks\"}}", CHROME_HYP_PID);
+  exp->events = 2;
+  return 0;
+}
+
+static void chrome_stop_running(struct zsv_chrome_export *exp, int rid, unsigned long long ts)
+{
+  if (exp->running[rid]){
+    chrome_event(exp, "E", "running", CHROME_GUEST_PID, rid, ts, NULL);
+    exp->running[rid] = 0;
+  }
+}
+
+static void chrome_end_job(struct zsv_chrome_export *exp, int rid, unsigned long long ts, const char *args)
+{
+  if (exp->job_open[rid]){
+    chrome_stop_running(exp, rid, ts);
+    chrome_event(exp, "E", "job", CHROME_GUEST_PID, rid, ts, args);
+    exp->job_open[rid] = 0;
+  }
+}
+
+static void chrome_hyp_record(struct zsv_chrome_export *exp, struct trace_rec_t *rec)
+{
+  int id = rec->rid;
+
+  if (!(exp->named[id] & 2)){
+    chrome_track_name(exp, CHROME_HYP_PID, id, "hyptask");
+    exp->named[id] |= 2;
+  }
+
+  switch(rec->event_type){
+  case ZSV_HYP_EVENT_HYPTASKEXEC_BEFORE:
+    if (!exp->hyp_running[id]){
+      chrome_event(exp, "B", "hyptask exec", CHROME_HYP_PID, id, rec->timestamp_ns, NULL);
+      exp->hyp_running[id] = 1;
+    }
+    break;
+  case ZSV_HYP_EVENT_HYPTASKEXEC_AFTER:
+    if (exp->hyp_running[id]){
+      chrome_event(exp, "E", "hyptask exec", CHROME_HYP_PID, id, rec->timestamp_ns, NULL);
+      exp->hyp_running[id] = 0;
+    }
+    break;
+  case ZSV_HYP_EVENT_CREATEHYPTASK_BEFORE:
+    chrome_event(exp, "i", "create hyptask", CHROME_HYP_PID, id, rec->timestamp_ns, NULL);
+    break;
+  case ZSV_HYP_EVENT_DISABLEHYPTASK_BEFORE:
+    chrome_event(exp, "i", "disable hyptask", CHROME_HYP_PID, id, rec->timestamp_ns, NULL);
+    break;
+  case ZSV_HYP_EVENT_DELETEHYPTASK_BEFORE:
+    chrome_event(exp, "i", "delete hyptask", CHROME_HYP_PID, id, rec->timestamp_ns, NULL);
+    break;
+  }
+}
+
+int zsv_chrome_export_record(struct zsv_chrome_export *exp, struct trace_rec_t *rec)
+{
+  int rid = rec->rid;
+  unsigned long long ts = rec->timestamp_ns;
+
+  if (rid < 0 || rid >= ZSV_TRACE_MAX_RIDS)
+    return -1;
+
+  if (rec->event_type >= ZSV_HYP_EVENT_BASE){
+    chrome_hyp_record(exp, rec);
+    return 0;
+  }
+
+  if (!(exp->named[rid] & 1)){
+    chrome_track_name(exp, CHROME_GUEST_PID, rid, "reserve");
+    exp->named[rid] |= 1;
+  }
+
+  switch(rec->event_type){
+  case TRACE_EVENT_START_PERIOD:
+  case TRACE_EVENT_START_PERIOD_PERIODIC_WAIT:
+  case TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_WAKEUP:
+  case TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_NO_WAKEUP:
+    // a job still open at the next release missed its deadline
+    chrome_end_job(exp, rid, ts, "{\"deadline_miss\":1}");
+    chrome_event(exp, "B", "job", CHROME_GUEST_PID, rid, ts, NULL);
+    chrome_event(exp, "B", "running", CHROME_GUEST_PID, rid, ts, NULL);
+    exp->job_open[rid] = 1;
+    exp->running[rid] = 1;
+    break;
+  case TRACE_EVENT_PREEMPTED:
+    chrome_stop_running(exp, rid, ts);
+    break;
+  case TRACE_EVENT_RESUMED:
+    if (exp->job_open[rid] && !exp->running[rid]){
+      chrome_event(exp, "B", "running", CHROME_GUEST_PID, rid, ts, NULL);
+      exp->running[rid] = 1;
+    }
+    break;
+  case TRACE_EVENT_BUDGET_ENFORCEMENT:
+    chrome_stop_running(exp, rid, ts);
+    chrome_event(exp, "i", "budget_enforced", CHROME_GUEST_PID, rid, ts, NULL);
+    break;
+  case TRACE_EVENT_ZERO_SLACK:
+    chrome_event(exp, "i", "zero_slack (critical mode)", CHROME_GUEST_PID, rid, ts, NULL);
+    break;
+  case TRACE_EVENT_WFNP:
+  case TRACE_EVENT_END_PERIOD:
+    chrome_end_job(exp, rid, ts, NULL);
+    break;
+  default:
+    chrome_event(exp, "i", STRING_TRACE_EVENT(rec->event_type), CHROME_GUEST_PID, rid, ts, NULL);
+    break;
+  }
+  return 0;
+}
+
+// jobs still open are shown as unfinished slices
+int zsv_chrome_export_end(struct zsv_chrome_export *exp)
+{
+  fprintf(exp->out, "\n]}\n");
+  return ferror(exp->out) ? -1 : 0;
 }
 
 int zsv_test_reserve(int schedfd, int option)
@@ -0,0 +1,238 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+/*
+ * Release jitter benchmark
+ *
+ * Runs a single periodic reserve for a number of jobs and measures the
+ * phase error of its releases and zero-slack instants against the
+ * ideal grid first_release + k * period. The wake-up times seen by the
+ * task are taken from CLOCK_MONOTONIC and the kernel instants from the
+ * scheduler trace (start_period and zero_slack events). A drift-free
+ * scheduler shows a bounded phase error with a slope close to zero;
+ * relative re-arming shows an error that grows with the job count.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sched.h>
+#include "../src/zsrmvapi.h"
+
+#define DEFAULT_TICKS_PER_SEC 19200000L // counter frequency of the Raspberry Pi 3
+
+struct phase_stats {
+  long n;
+  long long min_ns;
+  long long max_ns;
+  double sum_ns;
+  // least-squares fit of the phase error against the job number
+  double sk, skk, se, ske;
+};
+
+void phase_stats_init(struct phase_stats *st)
+{
+  memset(st, 0, sizeof(*st));
+}
+
+void phase_stats_add(struct phase_stats *st, long k, long long err_ns)
+{
+  if (st->n == 0 || err_ns < st->min_ns)
+    st->min_ns = err_ns;
+  if (st->n == 0 || err_ns > st->max_ns)
+    st->max_ns = err_ns;
+  st->n++;
+  st->sum_ns += err_ns;
+  st->sk += k;
+  st->skk += (double)k * k;
+  st->se += err_ns;
+  st->ske += (double)k * err_ns;
+}
+
+void phase_stats_print(const char *name, struct phase_stats *st)
+{
+  double slope = 0.0;
+  double den;
+
+  if (st->n == 0){
+    printf("%-14s no samples\n", name);
+    return;
+  }
+
+  den = st->n * st->skk - st->sk * st->sk;
+  if (den != 0.0)
+    slope = (st->n * st->ske - st->sk * st->se) / den;
+
+  printf("%-14s n=%ld min=%lld ns max=%lld ns jitter=%lld ns mean=%.1f ns drift=%.3f ns/period\n",
+	 name, st->n, st->min_ns, st->max_ns, st->max_ns - st->min_ns,
+	 st->sum_ns / st->n, slope);
+}
+
+// the attach logs START_PERIOD, the periodic releases the other variants
+int is_release(int type)
+{
+  return (type == TRACE_EVENT_START_PERIOD ||
+	  type == TRACE_EVENT_START_PERIOD_PERIODIC_WAIT ||
+	  type == TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_WAKEUP ||
+	  type == TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_NO_WAKEUP);
+}
+
+void usage(char *name)
+{
+  printf("usage: %s [-p period_ms] [-z zero_slack_ms] [-c exec_ms] [-b busy_ms] [-n jobs] [-f ticks_per_sec]\n", name);
+  printf("  -b busy_ms: time each job runs before waiting for the next period. Use a value\n");
+  printf("              larger than the zero-slack instant to measure zero-slack instants\n");
+}
+
+int main(int argc, char *argv[])
+{
+  long period_ms = 10;
+  long zs_ms = 8;
+  long exec_ms = 5;
+  long busy_ms = 0;
+  long njobs = 1000;
+  long long ticks_per_sec = DEFAULT_TICKS_PER_SEC;
+  unsigned long long period_ns;
+  unsigned long long zs_ns;
+  unsigned long long *wakeups;
+  unsigned long long tsbuf[1];
+  long bidx;
+  struct trace_rec_t *trace;
+  int trace_size;
+  int nrecs;
+  struct sched_param p;
+  struct phase_stats wake_stats, rel_stats, zs_stats;
+  long long first_release_ns = -1;
+  long long ts_ns;
+  long k;
+  int schedfd, rid, opt, i;
+
+  while ((opt = getopt(argc, argv, "p:z:c:b:n:f:h")) != -1){
+    switch(opt){
+    case 'p': period_ms = atol(optarg); break;
+    case 'z': zs_ms = atol(optarg); break;
+    case 'c': exec_ms = atol(optarg); break;
+    case 'b': busy_ms = atol(optarg); break;
+    case 'n': njobs = atol(optarg); break;
+    case 'f': ticks_per_sec = atoll(optarg); break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (period_ms <= 0 || njobs <= 1 || ticks_per_sec <= 0 || zs_ms > period_ms || exec_ms > zs_ms){
+    usage(argv[0]);
+    return -1;
+  }
+
+  period_ns = period_ms * 1000000ULL;
+  zs_ns = zs_ms * 1000000ULL;
+
+  wakeups = malloc(sizeof(unsigned long long) * njobs);
+  if (wakeups == NULL){
+    printf("could not allocate wake-up buffer\n");
+    return -1;
+  }
+
+  p.sched_priority = 60;
+  if (sched_setscheduler(getpid(), SCHED_FIFO,&p)<0){
+    printf("could not change my priority. Make sure you execute with sudo\n");
+    return -1;
+  }
+
+  if ((schedfd = zsv_open_scheduler()) < 0){
+    printf("could not open the scheduler\n");
+    return -1;
+  }
+
+  rid = zsv_create_reserve(schedfd,
+			   period_ms / 1000, (period_ms % 1000) * 1000000L,
+			   zs_ms / 1000, (zs_ms % 1000) * 1000000L,
+			   period_ms / 1000, (period_ms % 1000) * 1000000L,
+			   exec_ms / 1000, (exec_ms % 1000) * 1000000L,
+			   exec_ms / 1000, (exec_ms % 1000) * 1000000L,
+			   10, 10);
+  if (rid < 0){
+    printf("could not create reserve\n");
+    return -1;
+  }
+
+  // flush the trace of previous runs
+  trace_size = zsv_get_trace_size(schedfd);
+  if (trace_size > 0){
+    trace = malloc(sizeof(struct trace_rec_t) * trace_size);
+    if (trace != NULL){
+      read(schedfd, trace, sizeof(struct trace_rec_t) * trace_size);
+      free(trace);
+    }
+  }
+
+  zsv_attach_reserve(schedfd, getpid(), rid);
+
+  for (k=0; k<njobs; k++){
+    if (busy_ms > 0){
+      bidx = 0;
+      busy_timestamped(busy_ms, tsbuf, 0, &bidx);
+    }
+    zsv_wait_period(schedfd, rid);
+    wakeups[k] = get_now_ns();
+  }
+
+  zsv_delete_reserve(schedfd, rid);
+
+  // wake-up phase error relative to the first wake-up
+  phase_stats_init(&wake_stats);
+  for (k=0; k<njobs; k++){
+    phase_stats_add(&wake_stats, k, (long long)(wakeups[k] - (wakeups[0] + k * period_ns)));
+  }
+
+  // kernel release and zero-slack instants
+  phase_stats_init(&rel_stats);
+  phase_stats_init(&zs_stats);
+
+  // leave room for the hypervisor events appended during the read
+  trace_size = zsv_get_trace_size(schedfd) + 4096;
+  trace = malloc(sizeof(struct trace_rec_t) * trace_size);
+  if (trace == NULL){
+    printf("could not allocate trace buffer\n");
+    return -1;
+  }
+  nrecs = read(schedfd, trace, sizeof(struct trace_rec_t) * trace_size) / sizeof(struct trace_rec_t);
+
+  for (i=0; i<nrecs; i++){
+    if (trace[i].rid != rid)
+      continue;
+    ts_ns = (long long)((trace[i].timestamp_ns * 1000000000.0) / ticks_per_sec);
+    if (is_release(trace[i].event_type)){
+      if (first_release_ns < 0)
+	first_release_ns = ts_ns;
+      k = (long)((ts_ns - first_release_ns + (long long)period_ns/2) / (long long)period_ns);
+      phase_stats_add(&rel_stats, k, ts_ns - (first_release_ns + k * (long long)period_ns));
+    } else if (trace[i].event_type == TRACE_EVENT_ZERO_SLACK && first_release_ns >= 0){
+      k = (long)((ts_ns - first_release_ns - (long long)zs_ns + (long long)period_ns/2) / (long long)period_ns);
+      phase_stats_add(&zs_stats, k, ts_ns - (first_release_ns + k * (long long)period_ns + (long long)zs_ns));
+    }
+  }
+
+  printf("period=%ld ms zero-slack=%ld ms exec=%ld ms busy=%ld ms jobs=%ld ticks/s=%lld\n",
+	 period_ms, zs_ms, exec_ms, busy_ms, njobs, ticks_per_sec);
+  phase_stats_print("wakeup", &wake_stats);
+  phase_stats_print("release", &rel_stats);
+  phase_stats_print("zero-slack", &zs_stats);
+
+  free(trace);
+  free(wakeups);
+  zsv_close_scheduler(schedfd);
+
+  return 0;
+}
@@ -0,0 +1,235 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+/*
+ * Serial throughput benchmark
+ *
+ * Initializes the mixed-trust serial port (921600 bauds by default),
+ * pushes a number of bytes through zsv_mtserial_send() and waits until
+ * the transmit ring is drained. The throughput is computed from the
+ * bytes the UART accepted (the "Serial tx" counters of /proc/zsrmv) and
+ * compared with the line rate of 8N1 framing (bauds / 10 bytes/s).
+ *
+ * With -l the TX and RX lines are expected to be looped back (or the
+ * software hypervisor backend to be loaded) and a receiver thread checks
+ * that the byte sequence comes back intact.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "../src/zsrmvapi.h"
+
+#define PROC_FILE "/proc/zsrmv"
+#define DRAIN_TIMEOUT_SEC 30
+#define SEND_POLL_US 200
+
+struct serial_stats {
+  int tx_empty;
+  unsigned int tx_used;
+  unsigned int tx_size;
+  unsigned long long tx_sends;
+  unsigned long long tx_bytes;
+  unsigned long long tx_stalls;
+  unsigned long long tx_dropped;
+  char tx_mode[16];
+};
+
+int schedfd;
+volatile unsigned long long rx_bytes=0;
+volatile unsigned long long rx_errors=0;
+volatile int rx_done=0;
+
+int read_serial_stats(struct serial_stats *st)
+{
+  FILE *f;
+  char line[512];
+  char *p;
+  char state[16];
+  unsigned int read_idx, write_idx, high;
+
+  memset(st, 0, sizeof(*st));
+  if ((f = fopen(PROC_FILE, "r")) == NULL)
+    return -1;
+
+  while (fgets(line, sizeof(line), f) != NULL){
+    if (!strncmp(line, "Trans buffer:", 13)){
+      if (sscanf(line, "Trans buffer: %15s readIdx(%u) writeIdx(%u)", state, &read_idx, &write_idx) == 3){
+	st->tx_empty = !strcmp(state, "EMPTY");
+	st->tx_used = write_idx - read_idx;
+      }
+    } else if (!strncmp(line, "Serial tx:", 10)){
+      sscanf(line, "Serial tx: %15s sends(%llu) bytes(%llu) stalls(%llu)",
+	     st->tx_mode, &st->tx_sends, &st->tx_bytes, &st->tx_stalls);
+    } else if ((p = strstr(line, "tx size(")) != NULL){
+      sscanf(p, "tx size(%u) high(%u) dropped(%llu)", &st->tx_size, &high, &st->tx_dropped);
+    }
+  }
+  fclose(f);
+  if (st->tx_size > 0){
+    st->tx_used &= st->tx_size - 1;
+    // the indices wrap when the ring is full
+    if (st->tx_used == 0 && !st->tx_empty)
+      st->tx_used = st->tx_size;
+  }
+  return 0;
+}
+
+double now_sec(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void *receiver(void *arg)
+{
+  unsigned char buffer[256];
+  unsigned char expected = 0;
+  int n, i;
+
+  while (!rx_done){
+    n = zsv_mtserial_recv(schedfd, 0, buffer, sizeof(buffer));
+    for (i=0; i<n; i++){
+      if (buffer[i] != expected){
+	rx_errors++;
+	expected = buffer[i];
+      }
+      expected++;
+    }
+    if (n > 0)
+      rx_bytes += n;
+  }
+  return NULL;
+}
+
+void usage(char *name)
+{
+  printf("usage: %s [-b bauds] [-n bytes] [-c chunk_bytes] [-l]\n", name);
+  printf("  -l: check the bytes received through a TX->RX loopback\n");
+}
+
+int main(int argc, char *argv[])
+{
+  long bauds = 921600;
+  long nbytes = 1024 * 1024;
+  long chunk = 256;
+  int loopback = 0;
+  unsigned char *buffer;
+  unsigned char seq = 0;
+  struct serial_stats before, after;
+  pthread_t rx_thread;
+  double t0, t1, elapsed;
+  unsigned long long delivered;
+  long sent, i;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "b:n:c:lh")) != -1){
+    switch(opt){
+    case 'b': bauds = atol(optarg); break;
+    case 'n': nbytes = atol(optarg); break;
+    case 'c': chunk = atol(optarg); break;
+    case 'l': loopback = 1; break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (bauds <= 0 || nbytes <= 0 || chunk <= 0){
+    usage(argv[0]);
+    return -1;
+  }
+
+  if ((buffer = malloc(chunk)) == NULL){
+    printf("could not allocate send buffer\n");
+    return -1;
+  }
+
+  if ((schedfd = zsv_open_scheduler()) < 0){
+    printf("could not open the scheduler\n");
+    return -1;
+  }
+
+  zsv_mtserial_init(schedfd, bauds);
+
+  if (read_serial_stats(&before) < 0){
+    printf("could not read %s\n", PROC_FILE);
+    return -1;
+  }
+
+  if (chunk >= before.tx_size){
+    printf("chunk must be smaller than the tx ring (%u bytes)\n", before.tx_size);
+    return -1;
+  }
+
+  if (loopback)
+    pthread_create(&rx_thread, NULL, receiver, NULL);
+
+  t0 = now_sec();
+  for (sent=0; sent < nbytes; ){
+    long len = (nbytes - sent < chunk) ? nbytes - sent : chunk;
+
+    // a send that does not fit drops its tail: wait for room in the ring
+    read_serial_stats(&after);
+    while (after.tx_size - after.tx_used < len){
+      usleep(SEND_POLL_US);
+      read_serial_stats(&after);
+    }
+
+    for (i=0; i<len; i++)
+      buffer[i] = seq++;
+    zsv_mtserial_send(schedfd, 0, buffer, len);
+    sent += len;
+  }
+
+  // wait until the sending task hands the last byte to the UART
+  do {
+    usleep(1000);
+    read_serial_stats(&after);
+  } while (!after.tx_empty && now_sec() - t0 < DRAIN_TIMEOUT_SEC);
+  t1 = now_sec();
+
+  elapsed = t1 - t0;
+  delivered = after.tx_bytes - before.tx_bytes;
+
+  printf("bauds=%ld bytes=%ld chunk=%ld mode=%s\n", bauds, nbytes, chunk, after.tx_mode);
+  printf("elapsed=%.3f s delivered=%llu bytes dropped=%llu bytes%s\n",
+	 elapsed, delivered, after.tx_dropped - before.tx_dropped,
+	 (after.tx_empty ? "" : " (ring not drained)"));
+  printf("throughput=%.0f bytes/s line rate=%.0f bytes/s efficiency=%.1f%%\n",
+	 delivered / elapsed, bauds / 10.0, 100.0 * (delivered / elapsed) / (bauds / 10.0));
+  printf("sends=%llu avg bytes/send=%.1f stalls=%llu\n",
+	 after.tx_sends - before.tx_sends,
+	 (after.tx_sends > before.tx_sends ? (double)delivered / (after.tx_sends - before.tx_sends) : 0.0),
+	 after.tx_stalls - before.tx_stalls);
+
+  if (loopback){
+    // wait up to a second for the bytes still in flight
+    t0 = now_sec();
+    while (rx_bytes < delivered && now_sec() - t0 < 1.0)
+      usleep(1000);
+    printf("loopback: received=%llu bytes sequence errors=%llu\n", rx_bytes, rx_errors);
+    rx_done = 1;
+    // a last byte wakes the receiver blocked in zsv_mtserial_recv()
+    buffer[0] = seq;
+    zsv_mtserial_send(schedfd, 0, buffer, 1);
+    pthread_join(rx_thread, NULL);
+  }
+
+  free(buffer);
+  zsv_close_scheduler(schedfd);
+
+  return 0;
+}
@@ -0,0 +1,571 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+/*
+ * Trace analyzer
+ *
+ * Rebuilds the jobs of each reserve from a trace written by
+ * zsv_write_trace() (text) or zsv_write_trace_binary() and reports the
+ * distribution of response times, execution times and preemptions per
+ * reserve together with deadline misses and budget enforcements.
+ *
+ * A job starts at a start_period event and completes at the next
+ * wait_period or end_period event of its reserve. It executes from its
+ * release except between a preempted event and the next resumed event
+ * (or until a budget enforcement). Deadlines are implicit: a job that
+ * is still running when the next job of its reserve is released missed
+ * its deadline. A job still open at the end of the trace is reported
+ * separately.
+ *
+ * Traces are split in chunks parsed by one thread each: text traces at
+ * line boundaries and binary traces at block boundaries (version 1
+ * binary traces have no block lengths and are decoded by a single
+ * thread). The chunks collect the records of each reserve. The trace
+ * is written one CPU after another, so the records of a reserve are
+ * then sorted by timestamp (zsv_trace_sort()) before its jobs are
+ * rebuilt; the same threads rebuild the reserves in parallel.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../src/zsrmvapi.h"
+
+#define DEFAULT_TICKS_PER_SEC 19200000L // counter frequency of the Raspberry Pi 3
+#define MAX_RIDS ZSV_TRACE_MAX_RIDS
+
+struct vec {
+  unsigned long long *v;
+  size_t n;
+  size_t cap;
+};
+
+struct job {
+  int open;
+  int running;
+  int enforced;
+  unsigned long long release;
+  unsigned long long run_start;
+  unsigned long long exec;
+  unsigned long long preemptions;
+};
+
+struct rid_stats {
+  struct vec response;
+  struct vec exec;
+  struct vec preemptions;
+  unsigned long long misses;
+  unsigned long long enforcements;
+  int open; // a job was still open at the end of the trace
+  unsigned long long open_release;
+};
+
+struct rec_vec {
+  struct trace_rec_t *v;
+  size_t n;
+  size_t cap;
+};
+
+struct chunk {
+  pthread_t thread;
+  const char *start;
+  const char *end;
+  unsigned long long records;
+  int version; // of binary traces
+  int corrupted;
+  struct rec_vec rids[MAX_RIDS]; // in the order of the chunk
+};
+
+// reserves rebuilt by one thread
+struct rebuild {
+  pthread_t thread;
+  int first_rid;
+  int nthreads;
+  struct chunk *chunks;
+  int nchunks;
+  struct rid_stats *total;
+};
+
+int vec_push(struct vec *v, unsigned long long x)
+{
+  unsigned long long *nv;
+
+  if (v->n == v->cap){
+    v->cap = v->cap ? v->cap * 2 : 1024;
+    nv = realloc(v->v, v->cap * sizeof(unsigned long long));
+    if (nv == NULL){
+      fprintf(stderr, "out of memory\n");
+      exit(-1);
+    }
+    v->v = nv;
+  }
+  v->v[v->n++] = x;
+  return 0;
+}
+
+void vec_append(struct vec *dst, struct vec *src)
+{
+  size_t i;
+
+  for (i=0;i<src->n;i++)
+    vec_push(dst, src->v[i]);
+  free(src->v);
+  memset(src, 0, sizeof(*src));
+}
+
+int is_release(int type)
+{
+  return (type == TRACE_EVENT_START_PERIOD ||
+	  type == TRACE_EVENT_START_PERIOD_PERIODIC_WAIT ||
+	  type == TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_WAKEUP ||
+	  type == TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_NO_WAKEUP);
+}
+
+void job_stop_running(struct job *job, unsigned long long ts)
+{
+  if (job->running && ts >= job->run_start)
+    job->exec += ts - job->run_start;
+  job->running = 0;
+}
+
+void job_complete(struct job *job, struct rid_stats *st, unsigned long long ts)
+{
+  job_stop_running(job, ts);
+  vec_push(&st->response, ts - job->release);
+  vec_push(&st->exec, job->exec);
+  vec_push(&st->preemptions, job->preemptions);
+  job->open = 0;
+}
+
+void job_release(struct job *job, struct rid_stats *st, unsigned long long ts)
+{
+  if (job->open){
+    // still running at the release of the next job: deadline miss
+    st->misses++;
+    job_complete(job, st, ts);
+  }
+  memset(job, 0, sizeof(*job));
+  job->open = 1;
+  job->running = 1;
+  job->release = ts;
+  job->run_start = ts;
+}
+
+// feed an event that is not a release to the open job
+void job_event(struct job *job, struct rid_stats *st, int type, unsigned long long ts)
+{
+  if (!job->open)
+    return;
+
+  switch(type){
+  case TRACE_EVENT_PREEMPTED:
+    if (job->running){
+      job->preemptions++;
+      job_stop_running(job, ts);
+    }
+    break;
+  case TRACE_EVENT_RESUMED:
+    if (!job->running && !job->enforced){
+      job->running = 1;
+      job->run_start = ts;
+    }
+    break;
+  case TRACE_EVENT_BUDGET_ENFORCEMENT:
+    if (!job->enforced){
+      st->enforcements++;
+      job->enforced = 1;
+    }
+    job_stop_running(job, ts);
+    break;
+  case TRACE_EVENT_WFNP:
+  case TRACE_EVENT_END_PERIOD:
+    job_complete(job, st, ts);
+    break;
+  }
+}
+
+void chunk_add(struct chunk *c, int rid, unsigned long long ts, int type)
+{
+  struct rec_vec *r;
+  struct trace_rec_t *nv;
+
+  c->records++;
+  if (rid < 0 || rid >= MAX_RIDS || type >= ZSV_HYP_EVENT_BASE)
+    return;
+  r = &c->rids[rid];
+
+  if (r->n == r->cap){
+    r->cap = r->cap ? r->cap * 2 : 1024;
+    nv = realloc(r->v, r->cap * sizeof(struct trace_rec_t));
+    if (nv == NULL){
+      fprintf(stderr, "out of memory\n");
+      exit(-1);
+    }
+    r->v = nv;
+  }
+  r->v[r->n].rid = rid;
+  r->v[r->n].timestamp_ns = ts;
+  r->v[r->n].event_type = type;
+  r->n++;
+}
+
+// parse "rid timestamp event" lines
+const char *parse_long(const char *p, const char *end, long long *v)
+{
+  int neg = 0;
+
+  while (p < end && (*p == ' ' || *p == '\t'))
+    p++;
+  if (p < end && *p == '-'){
+    neg = 1;
+    p++;
+  }
+  if (p >= end || *p < '0' || *p > '9')
+    return NULL;
+  *v = 0;
+  while (p < end && *p >= '0' && *p <= '9')
+    *v = *v * 10 + (*p++ - '0');
+  if (neg)
+    *v = -*v;
+  return p;
+}
+
+void *parse_text_chunk(void *arg)
+{
+  struct chunk *c = arg;
+  const char *p = c->start;
+  const char *q;
+  long long rid, ts, type;
+
+  while (p < c->end){
+    q = parse_long(p, c->end, &rid);
+    if (q != NULL)
+      q = parse_long(q, c->end, &ts);
+    if (q != NULL)
+      q = parse_long(q, c->end, &type);
+    if (q != NULL)
+      chunk_add(c, (int) rid, (unsigned long long) ts, (int) type);
+    // next line
+    while (p < c->end && *p != '\n')
+      p++;
+    p++;
+  }
+  return NULL;
+}
+
+// rebuild the jobs of rid from its records in timestamp order
+void rebuild_rid(struct chunk *chunks, int nchunks, int rid, struct rid_stats *st)
+{
+  struct trace_rec_t *recs;
+  struct job job;
+  size_t n = 0;
+  size_t k;
+  int i;
+
+  for (i=0;i<nchunks;i++)
+    n += chunks[i].rids[rid].n;
+  if (n == 0)
+    return;
+
+  // concatenated in file order: the stable sort keeps the order of
+  // records of one CPU with the same timestamp
+  recs = malloc(n * sizeof(struct trace_rec_t));
+  if (recs == NULL){
+    fprintf(stderr, "out of memory\n");
+    exit(-1);
+  }
+  n = 0;
+  for (i=0;i<nchunks;i++){
+    memcpy(recs + n, chunks[i].rids[rid].v, chunks[i].rids[rid].n * sizeof(struct trace_rec_t));
+    n += chunks[i].rids[rid].n;
+    free(chunks[i].rids[rid].v);
+    memset(&chunks[i].rids[rid], 0, sizeof(struct rec_vec));
+  }
+  if (zsv_trace_sort(recs, n) < 0){
+    fprintf(stderr, "out of memory\n");
+    exit(-1);
+  }
+
+  memset(&job, 0, sizeof(job));
+  for (k=0;k<n;k++){
+    if (is_release(recs[k].event_type))
+      job_release(&job, st, recs[k].timestamp_ns);
+    else
+      job_event(&job, st, recs[k].event_type, recs[k].timestamp_ns);
+  }
+  if (job.open){
+    st->open = 1;
+    st->open_release = job.release;
+  }
+  free(recs);
+}
+
+void *rebuild_rids(void *arg)
+{
+  struct rebuild *rb = arg;
+  int rid;
+
+  for (rid=rb->first_rid; rid<MAX_RIDS; rid += rb->nthreads)
+    rebuild_rid(rb->chunks, rb->nchunks, rid, &rb->total[rid]);
+  return NULL;
+}
+
+int cmp_ull(const void *a, const void *b)
+{
+  unsigned long long x = *(const unsigned long long *)a;
+  unsigned long long y = *(const unsigned long long *)b;
+  return x < y ? -1 : x > y;
+}
+
+unsigned long long percentile(struct vec *v, double p)
+{
+  size_t i = (size_t)(p * (v->n - 1) + 0.5);
+  return v->v[i];
+}
+
+void print_dist(const char *name, struct vec *v, double scale, const char *unit)
+{
+  double sum = 0.0;
+  size_t i;
+
+  if (v->n == 0)
+    return;
+  qsort(v->v, v->n, sizeof(unsigned long long), cmp_ull);
+  for (i=0;i<v->n;i++)
+    sum += v->v[i];
+  printf("  %-12s min=%.1f avg=%.1f p50=%.1f p99=%.1f max=%.1f %s\n", name,
+	 v->v[0] * scale, (sum / v->n) * scale, percentile(v, 0.5) * scale,
+	 percentile(v, 0.99) * scale, v->v[v->n-1] * scale, unit);
+}
+
+void print_report(struct rid_stats *total, long long ticks_per_sec)
+{
+  double us = 1000000.0 / ticks_per_sec;
+  int rid;
+
+  for (rid=0; rid<MAX_RIDS; rid++){
+    if (total[rid].response.n == 0 && !total[rid].open)
+      continue;
+    printf("rid %d: jobs=%zu deadline_misses=%llu enforcements=%llu\n", rid,
+	   total[rid].response.n, total[rid].misses, total[rid].enforcements);
+    print_dist("response", &total[rid].response, us, "us");
+    print_dist("exec", &total[rid].exec, us, "us");
+    print_dist("preemptions", &total[rid].preemptions, 1.0, "");
+    if (total[rid].open)
+      printf("  open job released at %.1f us not completed at the end of the trace\n",
+	     total[rid].open_release * us);
+  }
+}
+
+void usage(char *name)
+{
+  printf("usage: %s [-j threads] [-f ticks_per_sec] trace_file\n", name);
+  printf("  trace_file: text (zsv_write_trace()) or binary (zsv_write_trace_binary()) trace\n");
+}
+
+// decode the blocks of a binary trace between start and end
+void *parse_binary_chunk(void *arg)
+{
+  struct chunk *c = arg;
+  struct zsv_trace_decoder dec;
+  struct trace_rec_t rec;
+  FILE *fid;
+  int ret;
+
+  if (c->start == c->end)
+    return NULL;
+  if ((fid = fmemopen((void *) c->start, c->end - c->start, "rb")) == NULL){
+    c->corrupted = 1;
+    return NULL;
+  }
+  zsv_trace_decoder_open_block(&dec, fid, c->version);
+  while ((ret = zsv_trace_decode_next(&dec, &rec, NULL)) > 0)
+    chunk_add(c, rec.rid, rec.timestamp_ns, rec.event_type);
+  if (ret < 0)
+    c->corrupted = 1;
+  fclose(fid);
+  return NULL;
+}
+
+static unsigned int get_le32(const char *p)
+{
+  const unsigned char *u = (const unsigned char *) p;
+
+  return u[0] | (u[1] << 8) | (u[2] << 16) | ((unsigned int) u[3] << 24);
+}
+
+/*
+ * Split the binary trace in data into at most nthreads chunks of whole
+ * blocks. Returns the number of chunks.
+ */
+int split_binary(const char *data, size_t len, struct chunk *chunks, int nthreads)
+{
+  size_t off = ZSV_TRACE_FILE_HEADER_BYTES;
+  int version = get_le32(data + 4);
+  int n = 1;
+  int i;
+
+  // version 1 traces have no block lengths and cannot be split
+  if (version < 2)
+    nthreads = 1;
+
+  chunks[0].start = data + off;
+  while (n < nthreads && off + ZSV_TRACE_BLOCK_HEADER_BYTES <= len){
+    off += ZSV_TRACE_BLOCK_HEADER_BYTES + get_le32(data + off);
+    if (off >= len)
+      break;
+    if (off >= (len / nthreads) * n){
+      chunks[n-1].end = data + off;
+      chunks[n++].start = data + off;
+    }
+  }
+  chunks[n-1].end = data + len;
+  for (i=0;i<n;i++)
+    chunks[i].version = version;
+  return n;
+}
+
+int main(int argc, char *argv[])
+{
+  long long ticks_per_sec = DEFAULT_TICKS_PER_SEC;
+  int nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  struct rid_stats *total;
+  struct chunk *chunks;
+  struct rebuild *rebuilds;
+  unsigned long long records = 0;
+  struct stat st;
+  const char *data;
+  const char *p;
+  size_t len;
+  int fd, opt, i, magic, nrebuilds;
+  void *(*parse)(void *);
+
+  while ((opt = getopt(argc, argv, "j:f:h")) != -1){
+    switch(opt){
+    case 'j': nthreads = atoi(optarg); break;
+    case 'f': ticks_per_sec = atoll(optarg); break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (optind >= argc || nthreads <= 0 || ticks_per_sec <= 0){
+    usage(argv[0]);
+    return -1;
+  }
+
+  // small traces use fewer chunks, but all the threads rebuild reserves
+  nrebuilds = (nthreads < MAX_RIDS ? nthreads : MAX_RIDS);
+  total = calloc(MAX_RIDS, sizeof(struct rid_stats));
+  rebuilds = calloc(nrebuilds, sizeof(struct rebuild));
+  if (total == NULL || rebuilds == NULL){
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+
+  if ((fd = open(argv[optind], O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    fprintf(stderr, "could not open %s\n", argv[optind]);
+    return -1;
+  }
+  len = st.st_size;
+  if (len == 0){
+    printf("empty trace\n");
+    return 0;
+  }
+  data = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED){
+    fprintf(stderr, "could not map %s\n", argv[optind]);
+    return -1;
+  }
+
+  if ((size_t) nthreads > len / 4096 + 1)
+    nthreads = len / 4096 + 1;
+  chunks = calloc(nthreads, sizeof(struct chunk));
+  if (chunks == NULL){
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+
+  // binary traces start with the magic number
+  magic = (len >= ZSV_TRACE_FILE_HEADER_BYTES && get_le32(data) == ZSV_TRACE_FILE_MAGIC);
+
+  if (magic){
+    if (get_le32(data + 4) < 1 || get_le32(data + 4) > ZSV_TRACE_FILE_VERSION){
+      fprintf(stderr, "could not decode %s\n", argv[optind]);
+      return -1;
+    }
+    // split at block boundaries
+    nthreads = split_binary(data, len, chunks, nthreads);
+    parse = parse_binary_chunk;
+  } else {
+    // split at line boundaries
+    p = data;
+    for (i=0;i<nthreads;i++){
+      chunks[i].start = p;
+      p = (i == nthreads-1) ? data + len : data + (len / nthreads) * (i+1);
+      if (p < chunks[i].start)
+	p = chunks[i].start;
+      while (p < data + len && p[-1] != '\n')
+	p++;
+      chunks[i].end = p;
+    }
+    parse = parse_text_chunk;
+  }
+
+  for (i=0;i<nthreads;i++){
+    if (pthread_create(&chunks[i].thread, NULL, parse, &chunks[i]) != 0){
+      fprintf(stderr, "could not create thread\n");
+      return -1;
+    }
+  }
+  for (i=0;i<nthreads;i++)
+    pthread_join(chunks[i].thread, NULL);
+
+  munmap((void *) data, len);
+  close(fd);
+
+  for (i=0;i<nthreads;i++){
+    if (chunks[i].corrupted){
+      fprintf(stderr, "truncated or corrupted trace in chunk %d\n", i);
+      break;
+    }
+  }
+
+  for (i=0;i<nthreads;i++)
+    records += chunks[i].records;
+
+  for (i=0;i<nrebuilds;i++){
+    rebuilds[i].first_rid = i;
+    rebuilds[i].nthreads = nrebuilds;
+    rebuilds[i].chunks = chunks;
+    rebuilds[i].nchunks = nthreads;
+    rebuilds[i].total = total;
+    if (pthread_create(&rebuilds[i].thread, NULL, rebuild_rids, &rebuilds[i]) != 0){
+      fprintf(stderr, "could not create thread\n");
+      return -1;
+    }
+  }
+  for (i=0;i<nrebuilds;i++)
+    pthread_join(rebuilds[i].thread, NULL);
+
+  printf("%llu records, %d threads, %lld ticks/s\n", records, nthreads, ticks_per_sec);
+  print_report(total, ticks_per_sec);
+
+  free(rebuilds);
+  free(chunks);
+  free(total);
+  return 0;
+}
@@ -0,0 +1,120 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+/*
+ * Trace converter
+ *
+ * Converts a binary trace file (zsv_write_trace_binary()) into the
+ * text format of zsv_write_trace() ("rid timestamp event" per line).
+ * With -r it records the current trace of the scheduler into a binary
+ * file instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/zsrmvapi.h"
+
+void usage(char *name)
+{
+  printf("usage: %s [-c] [binary_trace [text_trace]]\n", name);
+  printf("       %s -r binary_trace\n", name);
+  printf("  -c: add the cpu of each record as a fourth column\n");
+  printf("  -r: consume the trace of the scheduler into binary_trace\n");
+}
+
+int record_trace(char *fname)
+{
+  FILE *fid;
+  int schedfd, n;
+
+  if ((fid = fopen(fname, "wb")) == NULL){
+    printf("could not open %s\n", fname);
+    return -1;
+  }
+
+  if ((schedfd = zsv_open_scheduler()) < 0){
+    printf("could not open the scheduler\n");
+    fclose(fid);
+    return -1;
+  }
+
+  n = zsv_write_trace_binary(schedfd, fid);
+  zsv_close_scheduler(schedfd);
+  fclose(fid);
+
+  if (n < 0)
+    return -1;
+  fprintf(stderr, "%d records written to %s\n", n, fname);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct zsv_trace_decoder dec;
+  struct trace_rec_t rec;
+  FILE *in = stdin;
+  FILE *out = stdout;
+  int with_cpu = 0;
+  int record = 0;
+  long nrecs = 0;
+  int opt, cpu, ret;
+
+  while ((opt = getopt(argc, argv, "crh")) != -1){
+    switch(opt){
+    case 'c': with_cpu = 1; break;
+    case 'r': record = 1; break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (record){
+    if (optind >= argc){
+      usage(argv[0]);
+      return -1;
+    }
+    return record_trace(argv[optind]);
+  }
+
+  if (optind < argc && (in = fopen(argv[optind], "rb")) == NULL){
+    printf("could not open %s\n", argv[optind]);
+    return -1;
+  }
+  if (optind+1 < argc && (out = fopen(argv[optind+1], "w")) == NULL){
+    printf("could not open %s\n", argv[optind+1]);
+    return -1;
+  }
+
+  if (zsv_trace_decoder_open(&dec, in) < 0){
+    fprintf(stderr, "not a binary trace file\n");
+    return -1;
+  }
+
+  while ((ret = zsv_trace_decode_next(&dec, &rec, &cpu)) > 0){
+    if (with_cpu)
+      fprintf(out, "%d %llu %d %d\n", rec.rid, rec.timestamp_ns, rec.event_type, cpu);
+    else
+      fprintf(out, "%d %llu %d\n", rec.rid, rec.timestamp_ns, rec.event_type);
+    nrecs++;
+  }
+
+  if (ret < 0)
+    fprintf(stderr, "truncated or corrupted trace after %ld records\n", nrecs);
+
+  if (in != stdin)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+
+  return ret < 0 ? -1 : 0;
+}
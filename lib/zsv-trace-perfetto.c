@@ -0,0 +1,166 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+/*
+ * Perfetto / chrome://tracing exporter
+ *
+ * Converts a text (zsv_write_trace()) or binary
+ * (zsv_write_trace_binary()) trace, including the imported hypervisor
+ * events, into a Chrome trace-event JSON file that can be opened in
+ * ui.perfetto.dev. With -r it exports the current trace of the
+ * scheduler instead of a file. The trace is in time order only within
+ * each CPU, so the records are read first and exported sorted by
+ * timestamp (zsv_trace_sort()).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "../src/zsrmvapi.h"
+
+#define DEFAULT_TICKS_PER_SEC 19200000L // counter frequency of the Raspberry Pi 3
+
+struct rec_array {
+  struct trace_rec_t *v;
+  long n;
+  long cap;
+};
+
+void rec_push(struct rec_array *a, struct trace_rec_t *rec)
+{
+  struct trace_rec_t *nv;
+
+  if (a->n == a->cap){
+    a->cap = a->cap ? a->cap * 2 : 4096;
+    nv = realloc(a->v, a->cap * sizeof(struct trace_rec_t));
+    if (nv == NULL){
+      fprintf(stderr, "out of memory\n");
+      exit(-1);
+    }
+    a->v = nv;
+  }
+  a->v[a->n++] = *rec;
+}
+
+void usage(char *name)
+{
+  printf("usage: %s [-f ticks_per_sec] [trace_file|-r] [json_file]\n", name);
+  printf("  -r: export the trace of the scheduler (consumes it)\n");
+}
+
+int read_scheduler(struct rec_array *recs)
+{
+  struct zsv_trace_map map;
+  struct trace_rec_t *tracep;
+  struct trace_rec_t rec;
+  unsigned int idx;
+  int schedfd, cpu;
+
+  if ((schedfd = zsv_open_scheduler()) < 0){
+    fprintf(stderr, "could not open the scheduler\n");
+    return -1;
+  }
+  zsv_trace_sync(schedfd);
+  if (zsv_trace_map(schedfd, &map) < 0){
+    zsv_close_scheduler(schedfd);
+    return -1;
+  }
+  for (cpu=0; cpu < map.ctl->num_cpus; cpu++){
+    while ((tracep = zsv_trace_peek(&map, cpu, &idx)) != NULL){
+      rec = *tracep;
+      if (zsv_trace_consume(&map, cpu, idx))
+	rec_push(recs, &rec);
+    }
+  }
+  zsv_trace_unmap(&map);
+  zsv_close_scheduler(schedfd);
+  return 0;
+}
+
+int read_file(struct rec_array *recs, FILE *in)
+{
+  struct zsv_trace_decoder dec;
+  struct trace_rec_t rec;
+  int ret;
+
+  if (zsv_trace_decoder_open(&dec, in) == 0){
+    while ((ret = zsv_trace_decode_next(&dec, &rec, NULL)) > 0)
+      rec_push(recs, &rec);
+    if (ret < 0)
+      fprintf(stderr, "truncated or corrupted trace\n");
+    return ret;
+  }
+
+  // text trace
+  rewind(in);
+  while (fscanf(in, "%d %llu %d", &rec.rid, &rec.timestamp_ns, &rec.event_type) == 3)
+    rec_push(recs, &rec);
+  return 0;
+}
+
+int main(int argc, char *argv[])
+{
+  struct zsv_chrome_export exp;
+  struct rec_array recs;
+  long i;
+  long long ticks_per_sec = DEFAULT_TICKS_PER_SEC;
+  int from_scheduler = 0;
+  FILE *in = NULL;
+  FILE *out = stdout;
+  int opt, ret;
+
+  while ((opt = getopt(argc, argv, "f:rh")) != -1){
+    switch(opt){
+    case 'f': ticks_per_sec = atoll(optarg); break;
+    case 'r': from_scheduler = 1; break;
+    default:
+      usage(argv[0]);
+      return -1;
+    }
+  }
+
+  if (ticks_per_sec <= 0 || (!from_scheduler && optind >= argc)){
+    usage(argv[0]);
+    return -1;
+  }
+
+  if (!from_scheduler){
+    if ((in = fopen(argv[optind], "rb")) == NULL){
+      fprintf(stderr, "could not open %s\n", argv[optind]);
+      return -1;
+    }
+    optind++;
+  }
+  if (optind < argc && (out = fopen(argv[optind], "w")) == NULL){
+    fprintf(stderr, "could not open %s\n", argv[optind]);
+    return -1;
+  }
+
+  memset(&recs, 0, sizeof(recs));
+  ret = from_scheduler ? read_scheduler(&recs) : read_file(&recs, in);
+  if (zsv_trace_sort(recs.v, recs.n) < 0){
+    fprintf(stderr, "out of memory\n");
+    return -1;
+  }
+
+  zsv_chrome_export_begin(&exp, out, ticks_per_sec);
+  for (i=0; i<recs.n; i++)
+    zsv_chrome_export_record(&exp, &recs.v[i]);
+  if (zsv_chrome_export_end(&exp) < 0)
+    ret = -1;
+  free(recs.v);
+
+  if (in != NULL)
+    fclose(in);
+  if (out != stdout)
+    fclose(out);
+  return ret < 0 ? -1 : 0;
+}
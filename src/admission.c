@@ -55,6 +55,18 @@ int getNextInSet(struct reserve *rsvtable, int *cidx, int tablesize, struct rese
   return selectedIdx;
 }
 
+/*
+ * Number of arrivals of r in a window of window_ns. The timer slack of r
+ * is release jitter: a late release can push one more arrival into the
+ * window.
+ */
+unsigned long getNumArrivals(unsigned long long window_ns, struct reserve *r)
+{
+  unsigned long long w = window_ns + r->timer_slack_ns;
+
+  return w / r->period_ns + (w % r->period_ns >0 ? 1 : 0);
+}
+
 unsigned long long getExecTimeHigherPrioHigherCrit(struct reserve *r)
 {
   return r->nominal_exectime_ns;
@@ -79,32 +91,34 @@ unsigned long long getResponseTimeCritNs(struct reserve *rsvtable, int tablesize
   int idx=0;
   int selectedIdx=-1;
 
-  resp = newrsv->exectime_ns - newrsv->exectime_in_rm_ns;
+  // the response time is measured from the nominal release so it includes
+  // the release jitter due to the timer slack of the reserve
+  resp = newrsv->timer_slack_ns + newrsv->exectime_ns - newrsv->exectime_in_rm_ns;
 
   while (firsttime || (resp > prevResp && resp <= newrsv->period_ns)){
     firsttime=0;
     prevResp = resp;
 
-    resp = newrsv->exectime_ns - newrsv->exectime_in_rm_ns;
+    resp = newrsv->timer_slack_ns + newrsv->exectime_ns - newrsv->exectime_in_rm_ns;
 
     // get interference from Higher Priority Higher Criticality taskset
     idx=0;
     while((selectedIdx = getNextInSet(rsvtable, &idx, tablesize, newrsv, isHigherPrioHigherCrit)) >=0){
-      numArrivals = prevResp / rsvtable[selectedIdx].period_ns + (prevResp % rsvtable[selectedIdx].period_ns >0 ? 1 : 0);
+      numArrivals = getNumArrivals(prevResp, &rsvtable[selectedIdx]);
       resp += numArrivals * getExecTimeHigherPrioHigherCrit(&rsvtable[selectedIdx]);
     }
 
     // get interference from Lower Priority Higher Criticality taskset
     idx=0;
     while((selectedIdx = getNextInSet(rsvtable, &idx, tablesize, newrsv, isLowerPrioHigherCrit)) >=0){
-      numArrivals = prevResp / rsvtable[selectedIdx].period_ns + (prevResp % rsvtable[selectedIdx].period_ns >0 ? 1 : 0);
+      numArrivals = getNumArrivals(prevResp, &rsvtable[selectedIdx]);
       resp += numArrivals * getExecTimeLowerPrioHigherCrit(&rsvtable[selectedIdx]);
     }
 
     // get interference from Higher Priority Same Criticality taskset
     idx=0;
     while((selectedIdx = getNextInSet(rsvtable, &idx, tablesize, newrsv, isHigherPrioSameCrit)) >=0){
-      numArrivals = prevResp / rsvtable[selectedIdx].period_ns + (prevResp % rsvtable[selectedIdx].period_ns >0 ? 1 : 0);
+      numArrivals = getNumArrivals(prevResp, &rsvtable[selectedIdx]);
       resp += numArrivals * getExecTimeHigherPrioSameCrit(&rsvtable[selectedIdx]);
     }
   }
@@ -120,19 +134,19 @@ unsigned long long getRMInterference(struct reserve *rsvtable, int tablesize, st
   
   idx=0;
   while((selectedIdx = getNextInSet(rsvtable, &idx, tablesize, newrsv, isHigherPrioHigherCrit)) >=0){
-    numArrivals = Z / rsvtable[selectedIdx].period_ns + (Z % rsvtable[selectedIdx].period_ns >0 ? 1 : 0);
+    numArrivals = getNumArrivals(Z, &rsvtable[selectedIdx]);
     interf += numArrivals * rsvtable[selectedIdx].nominal_exectime_ns;
   }
 
   idx=0;
   while((selectedIdx = getNextInSet(rsvtable, &idx, tablesize, newrsv, isHigherPrioLowerCrit)) >=0){
-    numArrivals = Z / rsvtable[selectedIdx].period_ns + (Z % rsvtable[selectedIdx].period_ns >0 ? 1 : 0);
+    numArrivals = getNumArrivals(Z, &rsvtable[selectedIdx]);
     interf += numArrivals * rsvtable[selectedIdx].exectime_ns;
   }
 
   idx=0;
   while((selectedIdx = getNextInSet(rsvtable, &idx, tablesize, newrsv, isHigherPrioSameCrit)) >=0){
-    numArrivals = Z / rsvtable[selectedIdx].period_ns + (Z % rsvtable[selectedIdx].period_ns >0 ? 1 : 0);
+    numArrivals = getNumArrivals(Z, &rsvtable[selectedIdx]);
     interf += numArrivals * rsvtable[selectedIdx].exectime_ns;
   }
   
@@ -0,0 +1,70 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+
+/*
+ * Hypervisor backends of the scheduler
+ *
+ * All the hypmtscheduler and mavlinkserhb operations of the module go
+ * through a struct hyp_backend_ops selected at load time with the
+ * hyp_backend module parameter:
+ *
+ *   xmhf  the uberXMHF uberapps, reached with hypercalls (ARM only)
+ *   sw    a software stand-in that emulates hyptasks with hard-irq
+ *         hrtimers and the UART with a loopback buffer, so that the
+ *         scheduler (mixed-trust paths included) runs on any Linux host
+ *
+ * The operations have the semantics of the hypmtscheduler_* and
+ * mavlinkserhb_* calls of the kmodlibs, except that shared buffers are
+ * passed by their kernel virtual address: the xmhf backend converts
+ * them to the 32-bit physical addresses of the uhcalls.
+ */
+
+#ifndef __HYPBACKEND_H__
+#define __HYPBACKEND_H__
+
+#include "hypmtscheduler.h"
+
+struct hyp_backend_ops {
+  const char *name;
+
+  // set up and tear down the backend (called without zsrmlock)
+  bool (*init)(void);
+  void (*exit)(void);
+
+  // hypmtscheduler uberapp
+  bool (*createhyptask)(u32 first_period, u32 regular_period,
+			u32 priority, u32 hyptask_id, u32 *hyptask_handle);
+  bool (*disablehyptask)(u32 hyptask_handle);
+  bool (*guestjobstart)(u32 hyptask_handle);
+  bool (*deletehyptask)(u32 hyptask_handle);
+  bool (*dumpdebuglog)(u8 *dst_log_buffer, u32 *num_entries);
+  bool (*registerreleasedoorbell)(u32 doorbell_paddr, u32 virq);
+  bool (*registereventring)(hypmtscheduler_event_ring_t *ring, u32 ring_size_bytes);
+  bool (*batch)(hypmtscheduler_batch_cmd_t *cmds, u32 num_cmds);
+
+  // mavlinkserhb uberapp
+  void (*serial_initialize)(u32 baudrate);
+  bool (*serial_send)(u8 *buffer, u32 buf_len);
+  bool (*serial_checkrecv)(void);
+  bool (*serial_recv)(u8 *buffer, u32 max_len, u32 *len_read, bool *uartreadbufexhausted);
+  bool (*activatehbhyptask)(u32 first_period, u32 recurring_period, u32 priority);
+  bool (*deactivatehbhyptask)(void);
+  bool (*serial_registerrxirq)(u32 virq);
+  bool (*serial_registertxbuffer)(u8 *buffer, u32 buffer_size);
+  bool (*serial_sendspan)(u32 offset, u32 len, u32 *len_sent);
+};
+
+#ifdef CONFIG_ARM
+extern struct hyp_backend_ops hyp_backend_xmhf;
+#endif
+extern struct hyp_backend_ops hyp_backend_sw;
+
+#endif //__HYPBACKEND_H__
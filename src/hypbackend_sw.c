@@ -0,0 +1,454 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+
+/*
+ * Software hypervisor backend
+ *
+ * Stand-in for the uberXMHF uberapps on hosts without the hypervisor
+ * (e.g. a stock x86 Linux machine). Hyptasks are hrtimers that fire at
+ * the first period and at every regular period after it. Their
+ * expiration runs in hard-irq context, preempting the guest like the
+ * hypervisor does, and busy-waits hypsw_exec_us unless the guest job
+ * completed (disablehyptask) since the last guestjobstart. The events
+ * of the hypervisor log are produced in the same format, into the event
+ * ring if one is registered or else into the buffer returned by
+ * dumpdebuglog. The UART is a loopback buffer: what is sent is received.
+ *
+ * The release doorbell needs a virq from the hypervisor and is not
+ * emulated; releases stay driven by the period timers.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/types.h>
+#include <linux/string.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
+#include <linux/delay.h>
+#include <linux/math64.h>
+#include <asm/io.h>
+
+#include "hypbackend.h"
+
+extern unsigned long long get_now_ticks(void);
+
+// time the body of an emulated hyptask keeps the CPU
+static int hypsw_exec_us=100;
+module_param(hypsw_exec_us, int, 0660);
+
+typedef struct {
+  bool inuse;
+  bool disabled;	// guest job completed, skip the body this period
+  u32 hyptask_id;
+  u32 priority;
+  u64 regular_period_ns;
+  struct hrtimer timer;
+} hypsw_hyptask_t;
+
+static hypsw_hyptask_t hypsw_hyptasks[HYPMTSCHEDULER_MAX_HYPTASKS];
+
+// serializes the hyptasks and the log (the log has a single producer)
+static DEFINE_RAW_SPINLOCK(hypsw_lock);
+
+static hypmtscheduler_event_ring_t *hypsw_ring = NULL;
+static hypmtscheduler_logentry_t hypsw_log_buffer[DEBUG_LOG_SIZE];
+static u32 hypsw_log_count = 0;
+
+#define HYPSW_SERIAL_BUFFER_SIZE 4096
+
+static u8 hypsw_serial_buffer[HYPSW_SERIAL_BUFFER_SIZE];
+static u32 hypsw_serial_head = 0;
+static u32 hypsw_serial_count = 0;
+static DEFINE_RAW_SPINLOCK(hypsw_serial_lock);
+// registered tx buffer (guest memory is directly addressable here)
+static u8 *hypsw_serial_txbuffer;
+static u32 hypsw_serial_txbuffer_size;
+
+// hypervisor time units (HYPMTSCHEDULER_TIME_1SEC per second) to ns
+static u64 hypsw_time2ns(u32 time)
+{
+  return div_u64((u64)time * NSEC_PER_SEC, HYPMTSCHEDULER_TIME_1SEC);
+}
+
+// append an event to the hypervisor log. Called with hypsw_lock held
+static void hypsw_log(u32 hyptask_id, u32 event_type)
+{
+  hypmtscheduler_logentry_t *entry;
+  u32 head;
+
+  if (hypsw_ring != NULL){
+    head = hypsw_ring->head;
+    if (head - smp_load_acquire(&hypsw_ring->tail) >= HYPMTSCHEDULER_EVENT_RING_ENTRIES){
+      hypsw_ring->dropped++;
+      return;
+    }
+    entry = &hypsw_ring->entry[head & (HYPMTSCHEDULER_EVENT_RING_ENTRIES - 1)];
+  } else {
+    if (hypsw_log_count >= DEBUG_LOG_SIZE)
+      return;
+    entry = &hypsw_log_buffer[hypsw_log_count++];
+  }
+
+  entry->hyptask_id = hyptask_id;
+  entry->timestamp = get_now_ticks();
+  entry->event_type = event_type;
+
+  if (hypsw_ring != NULL)
+    smp_store_release(&hypsw_ring->head, head + 1);
+}
+
+static enum hrtimer_restart hypsw_hyptask_handler(struct hrtimer *timer)
+{
+  hypsw_hyptask_t *task = container_of(timer, hypsw_hyptask_t, timer);
+  unsigned long flags;
+
+  raw_spin_lock_irqsave(&hypsw_lock, flags);
+  if (!task->inuse){
+    raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+    return HRTIMER_NORESTART;
+  }
+
+  if (!task->disabled){
+    hypsw_log(task->hyptask_id, DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE);
+    raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+
+    // the CPU stays in the handler, like in the hypervisor
+    udelay(hypsw_exec_us);
+
+    raw_spin_lock_irqsave(&hypsw_lock, flags);
+    hypsw_log(task->hyptask_id, DEBUG_LOG_EVTTYPE_HYPTASKEXEC_AFTER);
+    if (!task->inuse){
+      raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+      return HRTIMER_NORESTART;
+    }
+  }
+
+  hrtimer_forward_now(timer, ns_to_ktime(task->regular_period_ns));
+  raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+  return HRTIMER_RESTART;
+}
+
+static bool hypsw_createhyptask(u32 first_period, u32 regular_period,
+			       u32 priority, u32 hyptask_id, u32 *hyptask_handle)
+{
+  unsigned long flags;
+  u32 i;
+
+  if (regular_period == 0 || hyptask_handle == NULL)
+    return false;
+
+  raw_spin_lock_irqsave(&hypsw_lock, flags);
+  for (i=0; i<HYPMTSCHEDULER_MAX_HYPTASKS; i++){
+    if (!hypsw_hyptasks[i].inuse && !hrtimer_active(&hypsw_hyptasks[i].timer))
+      break;
+  }
+  if (i == HYPMTSCHEDULER_MAX_HYPTASKS){
+    raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+    return false;
+  }
+
+  hypsw_log(hyptask_id, DEBUG_LOG_EVTTYPE_CREATEHYPTASK_BEFORE);
+  hypsw_hyptasks[i].inuse = true;
+  hypsw_hyptasks[i].disabled = false;
+  hypsw_hyptasks[i].hyptask_id = hyptask_id;
+  hypsw_hyptasks[i].priority = priority;
+  hypsw_hyptasks[i].regular_period_ns = hypsw_time2ns(regular_period);
+  hrtimer_start(&hypsw_hyptasks[i].timer, ns_to_ktime(hypsw_time2ns(first_period)), HRTIMER_MODE_REL);
+  hypsw_log(hyptask_id, DEBUG_LOG_EVTTYPE_CREATEHYPTASK_AFTER);
+  raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+
+  *hyptask_handle = i;
+  return true;
+}
+
+static bool hypsw_setdisabled(u32 hyptask_handle, bool disabled, u32 event_before, u32 event_after)
+{
+  unsigned long flags;
+
+  if (hyptask_handle >= HYPMTSCHEDULER_MAX_HYPTASKS)
+    return false;
+
+  raw_spin_lock_irqsave(&hypsw_lock, flags);
+  if (!hypsw_hyptasks[hyptask_handle].inuse){
+    raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+    return false;
+  }
+  hypsw_log(hypsw_hyptasks[hyptask_handle].hyptask_id, event_before);
+  hypsw_hyptasks[hyptask_handle].disabled = disabled;
+  hypsw_log(hypsw_hyptasks[hyptask_handle].hyptask_id, event_after);
+  raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+  return true;
+}
+
+static bool hypsw_disablehyptask(u32 hyptask_handle)
+{
+  return hypsw_setdisabled(hyptask_handle, true,
+			   DEBUG_LOG_EVTTYPE_DISABLEHYPTASK_BEFORE,
+			   DEBUG_LOG_EVTTYPE_DISABLEHYPTASK_AFTER);
+}
+
+static bool hypsw_guestjobstart(u32 hyptask_handle)
+{
+  return hypsw_setdisabled(hyptask_handle, false,
+			   DEBUG_LOG_EVTTYPE_STARTGUESTJOB_BEFORE,
+			   DEBUG_LOG_EVTTYPE_STARTGUESTJOB_AFTER);
+}
+
+static bool hypsw_deletehyptask(u32 hyptask_handle)
+{
+  unsigned long flags;
+
+  if (hyptask_handle >= HYPMTSCHEDULER_MAX_HYPTASKS)
+    return false;
+
+  raw_spin_lock_irqsave(&hypsw_lock, flags);
+  if (!hypsw_hyptasks[hyptask_handle].inuse){
+    raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+    return false;
+  }
+  hypsw_log(hypsw_hyptasks[hyptask_handle].hyptask_id, DEBUG_LOG_EVTTYPE_DELETEHYPTASK_BEFORE);
+  hypsw_hyptasks[hyptask_handle].inuse = false;
+  // the handler stops re-arming the timer once it sees the slot unused
+  hrtimer_try_to_cancel(&hypsw_hyptasks[hyptask_handle].timer);
+  hypsw_log(hypsw_hyptasks[hyptask_handle].hyptask_id, DEBUG_LOG_EVTTYPE_DELETEHYPTASK_AFTER);
+  raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+  return true;
+}
+
+static bool hypsw_dumpdebuglog(u8 *dst_log_buffer, u32 *num_entries)
+{
+  unsigned long flags;
+
+  if (dst_log_buffer == NULL || num_entries == NULL)
+    return false;
+
+  raw_spin_lock_irqsave(&hypsw_lock, flags);
+  memcpy(dst_log_buffer, hypsw_log_buffer, hypsw_log_count * sizeof(hypmtscheduler_logentry_t));
+  *num_entries = hypsw_log_count;
+  hypsw_log_count = 0;
+  raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+  return true;
+}
+
+static bool hypsw_registerreleasedoorbell(u32 doorbell_paddr, u32 virq)
+{
+  // unregistering is accepted, registering is not emulated
+  return doorbell_paddr == 0;
+}
+
+static bool hypsw_registereventring(hypmtscheduler_event_ring_t *ring, u32 ring_size_bytes)
+{
+  unsigned long flags;
+
+  if (ring != NULL && ring_size_bytes != sizeof(hypmtscheduler_event_ring_t))
+    return false;
+
+  raw_spin_lock_irqsave(&hypsw_lock, flags);
+  hypsw_ring = ring;
+  raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+  return true;
+}
+
+static bool hypsw_batch(hypmtscheduler_batch_cmd_t *cmds, u32 num_cmds)
+{
+  ugapp_hypmtscheduler_param_t *p;
+  bool status = true;
+  u32 i;
+
+  if (cmds == NULL || num_cmds == 0 || num_cmds > HYPMTSCHEDULER_BATCH_MAX_CMDS)
+    return false;
+
+  for (i=0; i<num_cmds; i++){
+    p = &cmds[i].param;
+    p->status = 0;
+    if (cmds[i].flags & HYPMTSCHEDULER_BATCH_PREV_HANDLE){
+      if (i == 0 || !cmds[i-1].param.status){
+	status = false;
+	continue;
+      }
+      p->iparam_1 = cmds[i-1].param.oparam_1;
+    }
+
+    switch(p->uhcall_fn){
+    case UAPP_HYPMTSCHEDULER_UHCALL_CREATEHYPTASK:
+      p->status = hypsw_createhyptask(p->iparam_1, p->iparam_2, p->iparam_3, p->iparam_4, &p->oparam_1);
+      break;
+    case UAPP_HYPMTSCHEDULER_UHCALL_DISABLEHYPTASK:
+      p->status = hypsw_disablehyptask(p->iparam_1);
+      break;
+    case UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART:
+      p->status = hypsw_guestjobstart(p->iparam_1);
+      break;
+    case UAPP_HYPMTSCHEDULER_UHCALL_DELETEHYPTASK:
+      p->status = hypsw_deletehyptask(p->iparam_1);
+      break;
+    }
+    if (!p->status)
+      status = false;
+  }
+  return status;
+}
+
+static void hypsw_serial_initialize(u32 baudrate)
+{
+  unsigned long flags;
+
+  raw_spin_lock_irqsave(&hypsw_serial_lock, flags);
+  hypsw_serial_head = 0;
+  hypsw_serial_count = 0;
+  raw_spin_unlock_irqrestore(&hypsw_serial_lock, flags);
+}
+
+static bool hypsw_serial_send(u8 *buffer, u32 buf_len)
+{
+  unsigned long flags;
+  u32 i;
+
+  raw_spin_lock_irqsave(&hypsw_serial_lock, flags);
+  if (buf_len > HYPSW_SERIAL_BUFFER_SIZE - hypsw_serial_count){
+    // like a full UART transmit buffer
+    raw_spin_unlock_irqrestore(&hypsw_serial_lock, flags);
+    return false;
+  }
+  for (i=0; i<buf_len; i++){
+    hypsw_serial_buffer[(hypsw_serial_head + hypsw_serial_count + i) % HYPSW_SERIAL_BUFFER_SIZE] = buffer[i];
+  }
+  hypsw_serial_count += buf_len;
+  raw_spin_unlock_irqrestore(&hypsw_serial_lock, flags);
+  return true;
+}
+
+static bool hypsw_serial_registertxbuffer(u8 *buffer, u32 buffer_size)
+{
+  hypsw_serial_txbuffer = buffer;
+  hypsw_serial_txbuffer_size = (buffer != NULL ? buffer_size : 0);
+  return true;
+}
+
+// accepts what fits in the loopback, like a UART with a full FIFO
+static bool hypsw_serial_sendspan(u32 offset, u32 len, u32 *len_sent)
+{
+  unsigned long flags;
+  u32 i, n;
+
+  if (hypsw_serial_txbuffer == NULL || offset > hypsw_serial_txbuffer_size ||
+      len > hypsw_serial_txbuffer_size - offset)
+    return false;
+
+  raw_spin_lock_irqsave(&hypsw_serial_lock, flags);
+  n = min(len, HYPSW_SERIAL_BUFFER_SIZE - hypsw_serial_count);
+  for (i=0; i<n; i++){
+    hypsw_serial_buffer[(hypsw_serial_head + hypsw_serial_count + i) % HYPSW_SERIAL_BUFFER_SIZE] = hypsw_serial_txbuffer[offset + i];
+  }
+  hypsw_serial_count += n;
+  raw_spin_unlock_irqrestore(&hypsw_serial_lock, flags);
+  *len_sent = n;
+  return true;
+}
+
+static bool hypsw_serial_checkrecv(void)
+{
+  return READ_ONCE(hypsw_serial_count) > 0;
+}
+
+static bool hypsw_serial_recv(u8 *buffer, u32 max_len, u32 *len_read, bool *uartreadbufexhausted)
+{
+  unsigned long flags;
+  u32 i, n;
+
+  raw_spin_lock_irqsave(&hypsw_serial_lock, flags);
+  n = min(max_len, hypsw_serial_count);
+  for (i=0; i<n; i++){
+    buffer[i] = hypsw_serial_buffer[(hypsw_serial_head + i) % HYPSW_SERIAL_BUFFER_SIZE];
+  }
+  hypsw_serial_head = (hypsw_serial_head + n) % HYPSW_SERIAL_BUFFER_SIZE;
+  hypsw_serial_count -= n;
+  *len_read = n;
+  *uartreadbufexhausted = (hypsw_serial_count == 0);
+  raw_spin_unlock_irqrestore(&hypsw_serial_lock, flags);
+  return true;
+}
+
+// the heartbeat hyptask only writes to the UART of the uberapp
+static bool hypsw_activatehbhyptask(u32 first_period, u32 recurring_period, u32 priority)
+{
+  return true;
+}
+
+static bool hypsw_deactivatehbhyptask(void)
+{
+  return true;
+}
+
+// there is no interrupt to raise: the receiver polls the loopback
+static bool hypsw_serial_registerrxirq(u32 virq)
+{
+  return false;
+}
+
+static bool hypsw_init(void)
+{
+  int i;
+
+  for (i=0; i<HYPMTSCHEDULER_MAX_HYPTASKS; i++){
+    memset(&hypsw_hyptasks[i], 0, sizeof(hypsw_hyptask_t));
+    hrtimer_init(&hypsw_hyptasks[i].timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+    hypsw_hyptasks[i].timer.function = hypsw_hyptask_handler;
+  }
+  hypsw_ring = NULL;
+  hypsw_log_count = 0;
+  hypsw_serial_initialize(0);
+  hypsw_serial_registertxbuffer(NULL, 0);
+  printk("ZSRMV.hypsw_init(): software hypervisor backend (hyptask exec %d us)\n", hypsw_exec_us);
+  return true;
+}
+
+static void hypsw_exit(void)
+{
+  unsigned long flags;
+  int i;
+
+  raw_spin_lock_irqsave(&hypsw_lock, flags);
+  for (i=0; i<HYPMTSCHEDULER_MAX_HYPTASKS; i++){
+    hypsw_hyptasks[i].inuse = false;
+  }
+  hypsw_ring = NULL;
+  raw_spin_unlock_irqrestore(&hypsw_lock, flags);
+
+  for (i=0; i<HYPMTSCHEDULER_MAX_HYPTASKS; i++){
+    hrtimer_cancel(&hypsw_hyptasks[i].timer);
+  }
+}
+
+struct hyp_backend_ops hyp_backend_sw = {
+  .name = "sw",
+  .init = hypsw_init,
+  .exit = hypsw_exit,
+  .createhyptask = hypsw_createhyptask,
+  .disablehyptask = hypsw_disablehyptask,
+  .guestjobstart = hypsw_guestjobstart,
+  .deletehyptask = hypsw_deletehyptask,
+  .dumpdebuglog = hypsw_dumpdebuglog,
+  .registerreleasedoorbell = hypsw_registerreleasedoorbell,
+  .registereventring = hypsw_registereventring,
+  .batch = hypsw_batch,
+  .serial_initialize = hypsw_serial_initialize,
+  .serial_send = hypsw_serial_send,
+  .serial_checkrecv = hypsw_serial_checkrecv,
+  .serial_recv = hypsw_serial_recv,
+  .activatehbhyptask = hypsw_activatehbhyptask,
+  .deactivatehbhyptask = hypsw_deactivatehbhyptask,
+  .serial_registerrxirq = hypsw_serial_registerrxirq,
+  .serial_registertxbuffer = hypsw_serial_registertxbuffer,
+  .serial_sendspan = hypsw_serial_sendspan,
+};
@@ -0,0 +1,119 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+
+/*
+ * uberXMHF backend: the hypmtscheduler and mavlinkserhb kmodlibs
+ */
+
+#include <linux/kernel.h>
+#include <linux/types.h>
+#include <linux/io.h>
+
+#include "hypbackend.h"
+
+extern bool hypmtscheduler_createhyptask(u32 first_period, u32 regular_period,
+			u32 priority, u32 hyptask_id, u32 *hyptask_handle);
+extern bool hypmtscheduler_disablehyptask(u32 hyptask_handle);
+extern bool hypmtscheduler_guestjobstart(u32 hyptask_handle);
+extern bool hypmtscheduler_deletehyptask(u32 hyptask_handle);
+extern bool hypmtscheduler_dumpdebuglog(u8 *dst_log_buffer, u32 *num_entries);
+extern bool hypmtscheduler_registerreleasedoorbell(u32 doorbell_paddr, u32 virq);
+extern bool hypmtscheduler_registereventring(u32 ring_paddr, u32 ring_size_bytes);
+extern bool hypmtscheduler_batch(hypmtscheduler_batch_cmd_t *cmds, u32 num_cmds);
+extern bool hypmtscheduler_kmodlib_init(void);
+extern void hypmtscheduler_kmodlib_exit(void);
+
+extern void mavlinkserhb_initialize(u32 baudrate);
+extern bool mavlinkserhb_send(u8 *buffer, u32 buf_len);
+extern bool mavlinkserhb_checkrecv(void);
+extern bool mavlinkserhb_recv(u8 *buffer, u32 max_len, u32 *len_read, bool *uartreadbufexhausted);
+extern bool mavlinkserhb_registerrxirq(u32 virq);
+extern bool mavlinkserhb_registertxbuffer(u32 buffer_paddr, u32 buffer_size);
+extern bool mavlinkserhb_sendspan(u32 offset, u32 len, u32 *len_sent);
+extern bool mavlinkserhb_activatehbhyptask(u32 first_period, u32 recurring_period,
+		u32 priority);
+extern bool mavlinkserhb_deactivatehbhyptask(void);
+extern bool mavlinkserhb_kmodlib_init(void);
+extern void mavlinkserhb_kmodlib_exit(void);
+
+static void xmhf_exit(void)
+{
+  hypmtscheduler_kmodlib_exit();
+  mavlinkserhb_kmodlib_exit();
+}
+
+// hypercall parameter pages (hypercalls are issued with zsrmlock held)
+static bool xmhf_init(void)
+{
+  if (!hypmtscheduler_kmodlib_init() || !mavlinkserhb_kmodlib_init()){
+    xmhf_exit();
+    return false;
+  }
+  return true;
+}
+
+// the uhcalls take 32-bit physical addresses of the shared buffers
+static bool xmhf_paddr32(void *buffer, u32 size, u32 *paddr)
+{
+  phys_addr_t pa = virt_to_phys(buffer);
+
+  if (pa + size - 1 > (phys_addr_t) U32_MAX){
+    printk("ZSRMV.xmhf_paddr32(): buffer at %pa above 4 GB\n", &pa);
+    return false;
+  }
+  *paddr = (u32) pa;
+  return true;
+}
+
+static bool xmhf_registereventring(hypmtscheduler_event_ring_t *ring, u32 ring_size_bytes)
+{
+  u32 ring_paddr;
+
+  if (ring == NULL)
+    return hypmtscheduler_registereventring(0, 0);
+  if (!xmhf_paddr32(ring, ring_size_bytes, &ring_paddr))
+    return false;
+  return hypmtscheduler_registereventring(ring_paddr, ring_size_bytes);
+}
+
+static bool xmhf_serial_registertxbuffer(u8 *buffer, u32 buffer_size)
+{
+  u32 buffer_paddr;
+
+  if (buffer == NULL)
+    return mavlinkserhb_registertxbuffer(0, 0);
+  if (!xmhf_paddr32(buffer, buffer_size, &buffer_paddr))
+    return false;
+  return mavlinkserhb_registertxbuffer(buffer_paddr, buffer_size);
+}
+
+struct hyp_backend_ops hyp_backend_xmhf = {
+  .name = "xmhf",
+  .init = xmhf_init,
+  .exit = xmhf_exit,
+  .createhyptask = hypmtscheduler_createhyptask,
+  .disablehyptask = hypmtscheduler_disablehyptask,
+  .guestjobstart = hypmtscheduler_guestjobstart,
+  .deletehyptask = hypmtscheduler_deletehyptask,
+  .dumpdebuglog = hypmtscheduler_dumpdebuglog,
+  .registerreleasedoorbell = hypmtscheduler_registerreleasedoorbell,
+  .registereventring = xmhf_registereventring,
+  .batch = hypmtscheduler_batch,
+  .serial_initialize = mavlinkserhb_initialize,
+  .serial_send = mavlinkserhb_send,
+  .serial_checkrecv = mavlinkserhb_checkrecv,
+  .serial_recv = mavlinkserhb_recv,
+  .activatehbhyptask = mavlinkserhb_activatehbhyptask,
+  .deactivatehbhyptask = mavlinkserhb_deactivatehbhyptask,
+  .serial_registerrxirq = mavlinkserhb_registerrxirq,
+  .serial_registertxbuffer = xmhf_serial_registertxbuffer,
+  .serial_sendspan = mavlinkserhb_sendspan,
+};
@@ -28,6 +28,9 @@ DM20-0619
 #define UAPP_HYPMTSCHEDULER_UHCALL_LOGTSC		6
 #define UAPP_HYPMTSCHEDULER_UHCALL_DUMPDEBUGLOG		7
 #define UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART        8
+#define UAPP_HYPMTSCHEDULER_UHCALL_REGISTERRELEASEDOORBELL 9
+#define UAPP_HYPMTSCHEDULER_UHCALL_REGISTEREVENTRING	10
+#define UAPP_HYPMTSCHEDULER_UHCALL_BATCH		11
 
 
 #define HYPMTSCHEDULER_MAX_HYPTASKID	4
@@ -115,6 +118,26 @@ typedef struct {
 	uint32_t status;
 }ugapp_hypmtscheduler_param_t;
 
+//vectored hypercall: UAPP_HYPMTSCHEDULER_UHCALL_BATCH takes the physical
+//address of a page of commands in iparam_1 and their number in
+//iparam_2. The hypervisor executes the commands in order, sets the
+//status (and oparams) of each one and returns the number executed in
+//oparam_1 with its own status set. An uberapp without the uhcall
+//leaves both at 0, which is the only case callers may fall back to
+//issuing the commands one at a time. With
+//HYPMTSCHEDULER_BATCH_PREV_HANDLE the iparam_1 of a command is replaced
+//by the hyptask handle returned (oparam_1) by the previous command,
+//which lets createhyptask be followed by operations on the new
+//hyptask; the command fails if the previous one failed.
+#define HYPMTSCHEDULER_BATCH_PREV_HANDLE	0x01
+
+typedef struct {
+	ugapp_hypmtscheduler_param_t param;
+	uint32_t flags;
+}hypmtscheduler_batch_cmd_t;
+
+#define HYPMTSCHEDULER_BATCH_MAX_CMDS	(4096 / sizeof(hypmtscheduler_batch_cmd_t))
+
 
 #define GUEST_JOB_START_VALID_MASK 0x01
 #define GUEST_JOB_END_VALID_MASK 0x02
@@ -139,6 +162,41 @@ typedef struct {
 
 #define DEBUG_LOG_SIZE (4096/sizeof(hypmtscheduler_logentry_t))
 
+//release doorbell: guest page where the hypervisor publishes the start
+//of every period of each hyptask (indexed by hyptask handle) before
+//raising the registered guest virq. An entry is updated under the
+//seqcount release_seq: the hypervisor increments it (to odd) before
+//writing release_timestamp and release_count and again (to even) after
+//them, with a barrier in between. The guest retries its read while
+//release_seq is odd or changed, since the 64-bit timestamp is two
+//stores on ARM32
+typedef struct {
+	u32 release_count;	//incremented at every period of the hyptask
+	u32 release_seq;	//odd while the entry is being written
+	u64 release_timestamp;	//counter value at the last period start
+} hypmtscheduler_release_doorbell_entry_t;
+
+typedef struct {
+	hypmtscheduler_release_doorbell_entry_t hyptask[HYPMTSCHEDULER_MAX_HYPTASKS];
+} hypmtscheduler_release_doorbell_t;
+
+//event ring: guest pages where the hypervisor appends its log entries
+//as they happen (single producer: hypervisor, single consumer: guest).
+//head and tail are free-running and index entry[] modulo size. The
+//producer writes the entry before publishing head and drops (counting
+//in dropped) when the ring is full; the consumer reads the entries
+//before publishing tail. No hypercall is needed to read the log.
+#define HYPMTSCHEDULER_EVENT_RING_ENTRIES	512	//power of two
+#define HYPMTSCHEDULER_EVENT_RING_ORDER		2	//4 pages
+
+typedef struct {
+	volatile u32 head;	//written by the hypervisor
+	volatile u32 tail;	//written by the guest
+	u32 size;		//number of entries, set by the guest
+	volatile u32 dropped;	//entries lost with the ring full
+	hypmtscheduler_logentry_t entry[HYPMTSCHEDULER_EVENT_RING_ENTRIES];
+} hypmtscheduler_event_ring_t;
+
 
 struct sched_timer *uapp_sched_timer_declare(u32 first_time_period,
 		u32 regular_time_period, int priority, HYPTHREADFUNC func);
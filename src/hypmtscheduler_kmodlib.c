@@ -53,6 +53,9 @@ DM20-0619
 #include <asm/uaccess.h>          // required for the copy to user function
 #include <asm/io.h>          // required for the copy to user function
 
+#include <linux/percpu.h>
+#include <linux/irqflags.h>
+
 #include "hypmtscheduler.h"
 
 #ifndef __HVC__
@@ -108,20 +111,86 @@ u32 hypmtscheduler_readtscfreq(void){
 	return tsc_freq;
 }
 
+//per-CPU hypercall parameter and buffer pages, allocated once at module
+//load (hypmtscheduler_kmodlib_init) so hypercalls do not allocate and
+//can be issued with interrupts disabled. A CPU uses its pages with
+//interrupts disabled from hmts_get_param() to hmts_put_param()
+typedef struct {
+	struct page *param_page;
+	ugapp_hypmtscheduler_param_t *param;
+	u32 param_paddr;
+	struct page *buffer_page;
+	void *buffer;
+	u32 buffer_paddr;
+} hypmtscheduler_hvc_pages_t;
+
+static hypmtscheduler_hvc_pages_t hmts_hvc_pages[NR_CPUS];
+
+void hypmtscheduler_kmodlib_exit(void){
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		if(hmts_hvc_pages[cpu].param_page)
+			__free_page(hmts_hvc_pages[cpu].param_page);
+		if(hmts_hvc_pages[cpu].buffer_page)
+			__free_page(hmts_hvc_pages[cpu].buffer_page);
+		memset(&hmts_hvc_pages[cpu], 0, sizeof(hypmtscheduler_hvc_pages_t));
+	}
+}
+
+bool hypmtscheduler_kmodlib_init(void){
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		hmts_hvc_pages[cpu].param_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		hmts_hvc_pages[cpu].buffer_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if(!hmts_hvc_pages[cpu].param_page || !hmts_hvc_pages[cpu].buffer_page){
+			hypmtscheduler_kmodlib_exit();
+			return false;
+		}
+		hmts_hvc_pages[cpu].param = (ugapp_hypmtscheduler_param_t *)page_address(hmts_hvc_pages[cpu].param_page);
+		hmts_hvc_pages[cpu].param_paddr = page_to_phys(hmts_hvc_pages[cpu].param_page);
+		hmts_hvc_pages[cpu].buffer = page_address(hmts_hvc_pages[cpu].buffer_page);
+		hmts_hvc_pages[cpu].buffer_paddr = page_to_phys(hmts_hvc_pages[cpu].buffer_page);
+	}
+	return true;
+}
+
+//get the (zeroed) parameter page of this CPU, NULL if not initialized
+static hypmtscheduler_hvc_pages_t *hmts_get_param(unsigned long *flags){
+	hypmtscheduler_hvc_pages_t *pages;
+
+	local_irq_save(*flags);
+	pages = &hmts_hvc_pages[smp_processor_id()];
+	if(!pages->param){
+		local_irq_restore(*flags);
+		return NULL;
+	}
+	memset(pages->param, 0, sizeof(ugapp_hypmtscheduler_param_t));
+	return pages;
+}
+
+static void hmts_put_param(unsigned long flags){
+	local_irq_restore(flags);
+}
+
+//issue the hypercall with the parameters of pages, returns its status
+static bool hmts_hvc(hypmtscheduler_hvc_pages_t *pages){
+	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, pages->param_paddr, sizeof(ugapp_hypmtscheduler_param_t));
+	return pages->param->status ? true : false;
+}
+
 bool hypmtscheduler_createhyptask(u32 first_period, u32 regular_period,
 			u32 priority, u32 hyptask_id, u32 *hyptask_handle){
 
+	hypmtscheduler_hvc_pages_t *pages;
 	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
-
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	unsigned long flags;
 
-	if(!hmtsp_page){
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
-
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
+	hmtsp = pages->param;
 
 	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_CREATEHYPTASK;
     hmtsp->iparam_1 = first_period;	//first period
@@ -129,134 +198,148 @@ bool hypmtscheduler_createhyptask(u32 first_period, u32 regular_period,
     hmtsp->iparam_3 = priority;						//priority
     hmtsp->iparam_4 = hyptask_id;						//hyptask id
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
-
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
+	if(!hmts_hvc(pages)){
+		hmts_put_param(flags);
 		return false;
 	}
 
 	*hyptask_handle = hmtsp->oparam_1;
 
-	__free_page(hmtsp_page);
+	hmts_put_param(flags);
 	return true;
 }
 
 
-bool hypmtscheduler_disablehyptask(u32 hyptask_handle){
+//hypercalls that only take the hyptask handle
+static bool hmts_hyptask_call(u8 uhcall_fn, u32 hyptask_handle){
 
-	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
+	hypmtscheduler_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!hmtsp_page){
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
 
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
+	pages->param->uhcall_fn = uhcall_fn;
+	pages->param->iparam_1 = hyptask_handle;	//handle of hyptask
 
-	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_DISABLEHYPTASK;
-    hmtsp->iparam_1 = hyptask_handle;	//handle of hyptask
+	status = hmts_hvc(pages);
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
+	hmts_put_param(flags);
+	return status;
+}
 
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
-		return false;
-	}
 
-	__free_page(hmtsp_page);
-	return true;
+bool hypmtscheduler_disablehyptask(u32 hyptask_handle){
+	return hmts_hyptask_call(UAPP_HYPMTSCHEDULER_UHCALL_DISABLEHYPTASK, hyptask_handle);
 }
 
 
 bool hypmtscheduler_guestjobstart(u32 hyptask_handle){
+	return hmts_hyptask_call(UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART, hyptask_handle);
+}
 
-	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
 
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+bool hypmtscheduler_deletehyptask(u32 hyptask_handle){
+	return hmts_hyptask_call(UAPP_HYPMTSCHEDULER_UHCALL_DELETEHYPTASK, hyptask_handle);
+}
 
-	if(!hmtsp_page){
-		return false;
-	}
 
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
+//set once the hypervisor has rejected the batch uhcall (uberapp without
+//the vectored uhcall: it neither reports a status nor executes any
+//command); batches are then issued one command at a time
+static bool hmts_batch_unsupported = false;
 
-	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART;
-    hmtsp->iparam_1 = hyptask_handle;	//handle of hyptask
+//execute num_cmds commands with a single hypercall. The status and
+//oparams of each command are written back to cmds. Returns true if
+//all the commands succeeded
+bool hypmtscheduler_batch(hypmtscheduler_batch_cmd_t *cmds, u32 num_cmds){
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
+	hypmtscheduler_hvc_pages_t *pages;
+	hypmtscheduler_batch_cmd_t *bcmds;
+	ugapp_hypmtscheduler_param_t *hmtsp;
+	unsigned long flags;
+	bool status = true;
+	u32 i, executed;
 
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
+	if(!cmds || num_cmds == 0 || num_cmds > HYPMTSCHEDULER_BATCH_MAX_CMDS){
 		return false;
 	}
 
-	__free_page(hmtsp_page);
-	return true;
-}
-
-
-bool hypmtscheduler_deletehyptask(u32 hyptask_handle){
-
-	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
-
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!hmtsp_page){
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
+	hmtsp = pages->param;
+
+	if(!hmts_batch_unsupported){
+		bcmds = (hypmtscheduler_batch_cmd_t *)pages->buffer;
+		memcpy(bcmds, cmds, num_cmds * sizeof(hypmtscheduler_batch_cmd_t));
+		for(i=0; i < num_cmds; i++)
+			bcmds[i].param.status = 0;
+		hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_BATCH;
+		hmtsp->iparam_1 = pages->buffer_paddr;
+		hmtsp->iparam_2 = num_cmds;
+
+		hmts_hvc(pages);
+		executed = hmtsp->oparam_1;
+
+		if(hmtsp->status || executed > 0){
+			//commands past the ones executed did not run: they
+			//are failed, never replayed
+			if(executed > num_cmds)
+				executed = num_cmds;
+			memcpy(cmds, bcmds, executed * sizeof(hypmtscheduler_batch_cmd_t));
+			for(i=executed; i < num_cmds; i++)
+				cmds[i].param.status = 0;
+			goto out;
+		}
+		//nothing ran: safe to issue the commands one at a time
+		hmts_batch_unsupported = true;
+		memset(hmtsp, 0, sizeof(ugapp_hypmtscheduler_param_t));
+	}
 
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
-
-	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_DELETEHYPTASK;
-    hmtsp->iparam_1 = hyptask_handle;	//handle of hyptask
+	for(i=0; i < num_cmds; i++){
+		memcpy(hmtsp, &cmds[i].param, sizeof(ugapp_hypmtscheduler_param_t));
+		hmtsp->status = 0;
+		if(cmds[i].flags & HYPMTSCHEDULER_BATCH_PREV_HANDLE){
+			if(i == 0 || !cmds[i-1].param.status){
+				cmds[i].param.status = 0;
+				continue;
+			}
+			hmtsp->iparam_1 = cmds[i-1].param.oparam_1;
+		}
+		hmts_hvc(pages);
+		memcpy(&cmds[i].param, hmtsp, sizeof(ugapp_hypmtscheduler_param_t));
+	}
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
+out:
+	hmts_put_param(flags);
 
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
-		return false;
+	for(i=0; i < num_cmds; i++){
+		if(!cmds[i].param.status)
+			status = false;
 	}
-
-	__free_page(hmtsp_page);
-	return true;
+	return status;
 }
 
 
 bool hypmtscheduler_getrawtick64(u64 *tickcount){
 
+	hypmtscheduler_hvc_pages_t *pages;
 	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
+	unsigned long flags;
 	u64 l_tickcount;
 
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!hmtsp_page || !tickcount){
+	if(!tickcount || !(pages = hmts_get_param(&flags))){
 		return false;
 	}
-
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
+	hmtsp = pages->param;
 
 	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_GETRAWTICK;
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
-
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
+	if(!hmts_hvc(pages)){
+		hmts_put_param(flags);
 		return false;
 	}
 
@@ -265,115 +348,130 @@ bool hypmtscheduler_getrawtick64(u64 *tickcount){
 	l_tickcount = l_tickcount << 32;
 	l_tickcount |= hmtsp->oparam_2;
 
-	printk(KERN_INFO "hypmtscheduler_getrawtick64: oparam_1 = 0x%08x\n", hmtsp->oparam_1);
-	printk(KERN_INFO "hypmtscheduler_getrawtick64: oparam_2 = 0x%08x\n", hmtsp->oparam_2);
+	hmts_put_param(flags);
+
 	printk(KERN_INFO "hypmtscheduler_getrawtick64: l_tickcount = 0x%016llx\n", l_tickcount);
 
 	//*tickcount = (u64)((hmtsp->oparam_1 << 32) | hmtsp->oparam_2);
 	*tickcount = l_tickcount;
-	__free_page(hmtsp_page);
 
 	return true;
 }
 
 bool hypmtscheduler_getrawtick32(u32 *tickcount){
 
-	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
-
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	hypmtscheduler_hvc_pages_t *pages;
+	unsigned long flags;
 
-	if(!hmtsp_page || !tickcount){
+	if(!tickcount || !(pages = hmts_get_param(&flags))){
 		return false;
 	}
 
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
-
-	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_GETRAWTICK;
+	pages->param->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_GETRAWTICK;
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
-
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
+	if(!hmts_hvc(pages)){
+		hmts_put_param(flags);
 		return false;
 	}
 
-	*tickcount = hmtsp->oparam_2;
+	*tickcount = pages->param->oparam_2;
 
-	__free_page(hmtsp_page);
+	hmts_put_param(flags);
 	return true;
 }
 
 
 bool hypmtscheduler_inittsc(void){
 
-	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
-
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	hypmtscheduler_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	if(!hmtsp_page){
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
 
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
+	pages->param->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_INITTSC;
 
-	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_INITTSC;
+	status = hmts_hvc(pages);
+
+	hmts_put_param(flags);
+	return status;
+}
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
 
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
+bool hypmtscheduler_logtsc(u32 event){
+
+	hypmtscheduler_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
+
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
 
-	__free_page(hmtsp_page);
-	return true;
+	pages->param->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_LOGTSC;
+	pages->param->iparam_1 = event;
+
+	status = hmts_hvc(pages);
+
+	hmts_put_param(flags);
+	return status;
 }
 
 
-bool hypmtscheduler_logtsc(u32 event){
 
-	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
+//register (or unregister with doorbell_paddr = 0) the release doorbell
+//page and the virq raised by the hypervisor at every hyptask period
+bool hypmtscheduler_registerreleasedoorbell(u32 doorbell_paddr, u32 virq){
 
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	hypmtscheduler_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	if(!hmtsp_page){
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
 
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
+	pages->param->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_REGISTERRELEASEDOORBELL;
+	pages->param->iparam_1 = doorbell_paddr;
+	pages->param->iparam_2 = virq;
+
+	status = hmts_hvc(pages);
+
+	hmts_put_param(flags);
+	return status;
+}
+
 
-	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_LOGTSC;
-	hmtsp->iparam_1 = event;
+//register the event ring (hypmtscheduler_event_ring_t) at ring_paddr;
+//a ring_paddr of 0 unregisters it and restores the debug log buffer
+bool hypmtscheduler_registereventring(u32 ring_paddr, u32 ring_size_bytes){
 
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
+	hypmtscheduler_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	if(!hmtsp->status){
-		__free_page(hmtsp_page);
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
 
-	__free_page(hmtsp_page);
-	return true;
-}
+	pages->param->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_REGISTEREVENTRING;
+	pages->param->iparam_1 = ring_paddr;
+	pages->param->iparam_2 = ring_size_bytes;
 
+	status = hmts_hvc(pages);
+
+	hmts_put_param(flags);
+	return status;
+}
 
 
 bool hypmtscheduler_dumpdebuglog(u8 *dst_log_buffer, u32 *num_entries){
 
+	hypmtscheduler_hvc_pages_t *pages;
 	ugapp_hypmtscheduler_param_t *hmtsp;
-	struct page *hmtsp_page;
-	u32 hmtsp_paddr;
-	struct page *debug_log_buffer_page;
-	u32 debug_log_buffer_page_paddr;
+	unsigned long flags;
 
 	if(!dst_log_buffer || !num_entries){
 		return false;
@@ -381,45 +479,24 @@ bool hypmtscheduler_dumpdebuglog(u8 *dst_log_buffer, u32 *num_entries){
 
 	*num_entries=0;
 
-	//allocate physical page for parameter passing
-	hmtsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!hmtsp_page){
+	if(!(pages = hmts_get_param(&flags))){
 		return false;
 	}
+	hmtsp = pages->param;
 
-	hmtsp = (ugapp_hypmtscheduler_param_t *)page_address(hmtsp_page);
-
-
-	//allocate debug log buffer page and compute its physical address
-	debug_log_buffer_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!debug_log_buffer_page){
-		return false;
-	}
-
-	debug_log_buffer_page_paddr = page_to_phys(debug_log_buffer_page);
-
-
+	//the hypervisor writes the log into the buffer page of this CPU
 	hmtsp->uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_DUMPDEBUGLOG;
-	hmtsp->iparam_1 = debug_log_buffer_page_paddr;
-
-	hmtsp_paddr = page_to_phys(hmtsp_page);
-	__hvc(UAPP_HYPMTSCHEDULER_UHCALL, hmtsp_paddr, sizeof(ugapp_hypmtscheduler_param_t));
+	hmtsp->iparam_1 = pages->buffer_paddr;
 
-	if(!hmtsp->status){
-		__free_page(debug_log_buffer_page);
-		__free_page(hmtsp_page);
+	if(!hmts_hvc(pages)){
+		hmts_put_param(flags);
 		return false;
 	}
 
-	memcpy(dst_log_buffer, page_address(debug_log_buffer_page),
+	memcpy(dst_log_buffer, pages->buffer,
 			hmtsp->oparam_1 * sizeof(hypmtscheduler_logentry_t));
 	*num_entries = hmtsp->oparam_1;
 
-	__free_page(debug_log_buffer_page);
-	__free_page(hmtsp_page);
+	hmts_put_param(flags);
 	return true;
 }
-
-
@@ -26,6 +26,19 @@ DM20-0619
 #define UAPP_MAVLINKSERHB_UHCALL_RECV					4
 #define UAPP_MAVLINKSERHB_UHCALL_ACTIVATEHBHYPTASK		5
 #define UAPP_MAVLINKSERHB_UHCALL_DEACTIVATEHBHYPTASK	6
+#define UAPP_MAVLINKSERHB_UHCALL_REGISTERRXIRQ		7
+#define UAPP_MAVLINKSERHB_UHCALL_REGISTERTXBUFFER	8
+#define UAPP_MAVLINKSERHB_UHCALL_SENDSPAN				9
+
+//rx irq: virtual interrupt (iparam_1, 0 to unregister) raised when the
+//UART receive buffer goes from empty to non-empty, i.e., the first byte
+//that arrives after a RECV that reported the buffer exhausted
+
+//tx buffer: physically contiguous guest pages (iparam_1 paddr, iparam_2
+//size, 0 to unregister) registered once. SENDSPAN sends iparam_2 bytes
+//at offset iparam_1 of the tx buffer straight to the UART, without a
+//copy through the parameter pages. oparam_1 = bytes accepted, limited by
+//the UART FIFO and flow control (0 if it cannot take any now)
 
 
 #ifndef __ASSEMBLY__
@@ -54,6 +54,9 @@ DM20-0619
 #include <asm/uaccess.h>          // required for the copy to user function
 #include <asm/io.h>          // required for the copy to user function
 
+#include <linux/percpu.h>
+#include <linux/irqflags.h>
+
 #include "mavlinkserhb.h"
 
 
@@ -81,32 +84,90 @@ extern void __hvc(u32 uhcall_function, void *uhcall_buffer,
 #endif
 
 
-void mavlinkserhb_initialize(u32 baudrate){
+//per-CPU hypercall parameter and buffer pages, allocated once at module
+//load (mavlinkserhb_kmodlib_init). A CPU uses its pages with interrupts
+//disabled from mlhb_get_param() to mlhb_put_param()
+typedef struct {
+	struct page *param_page;
+	uapp_mavlinkserhb_param_t *param;
+	u32 param_paddr;
+	struct page *buffer_page;
+	void *buffer;
+	u32 buffer_paddr;
+} mavlinkserhb_hvc_pages_t;
 
-	uapp_mavlinkserhb_param_t *mlhbsp;
-	struct page *mlhbsp_page;
-	u32 mlhbsp_paddr;
+static mavlinkserhb_hvc_pages_t mlhb_hvc_pages[NR_CPUS];
 
-	mlhbsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+void mavlinkserhb_kmodlib_exit(void){
+	int cpu;
 
-	if(!mlhbsp_page){
-		return false;
+	for_each_possible_cpu(cpu){
+		if(mlhb_hvc_pages[cpu].param_page)
+			__free_page(mlhb_hvc_pages[cpu].param_page);
+		if(mlhb_hvc_pages[cpu].buffer_page)
+			__free_page(mlhb_hvc_pages[cpu].buffer_page);
+		memset(&mlhb_hvc_pages[cpu], 0, sizeof(mavlinkserhb_hvc_pages_t));
+	}
+}
+
+bool mavlinkserhb_kmodlib_init(void){
+	int cpu;
+
+	for_each_possible_cpu(cpu){
+		mlhb_hvc_pages[cpu].param_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		mlhb_hvc_pages[cpu].buffer_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if(!mlhb_hvc_pages[cpu].param_page || !mlhb_hvc_pages[cpu].buffer_page){
+			mavlinkserhb_kmodlib_exit();
+			return false;
+		}
+		mlhb_hvc_pages[cpu].param = (uapp_mavlinkserhb_param_t *)page_address(mlhb_hvc_pages[cpu].param_page);
+		mlhb_hvc_pages[cpu].param_paddr = page_to_phys(mlhb_hvc_pages[cpu].param_page);
+		mlhb_hvc_pages[cpu].buffer = page_address(mlhb_hvc_pages[cpu].buffer_page);
+		mlhb_hvc_pages[cpu].buffer_paddr = page_to_phys(mlhb_hvc_pages[cpu].buffer_page);
+	}
+	return true;
+}
+
+//get the (zeroed) parameter page of this CPU, NULL if not initialized
+static mavlinkserhb_hvc_pages_t *mlhb_get_param(unsigned long *flags){
+	mavlinkserhb_hvc_pages_t *pages;
+
+	local_irq_save(*flags);
+	pages = &mlhb_hvc_pages[smp_processor_id()];
+	if(!pages->param){
+		local_irq_restore(*flags);
+		return NULL;
 	}
+	memset(pages->param, 0, sizeof(uapp_mavlinkserhb_param_t));
+	return pages;
+}
 
-	mlhbsp = (uapp_mavlinkserhb_param_t *)page_address(mlhbsp_page);
+static void mlhb_put_param(unsigned long flags){
+	local_irq_restore(flags);
+}
 
-	mlhbsp->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_INITIALIZE;
-	mlhbsp->iparam_1 = baudrate;
+//issue the hypercall with the parameters of pages, returns its status
+static bool mlhb_hvc(mavlinkserhb_hvc_pages_t *pages){
+	__hvc(UAPP_MAVLINKSERHB_UHCALL, pages->param_paddr, sizeof(uapp_mavlinkserhb_param_t));
+	return pages->param->status ? true : false;
+}
 
-	mlhbsp_paddr = page_to_phys(mlhbsp_page);
-	__hvc(UAPP_MAVLINKSERHB_UHCALL, mlhbsp_paddr, sizeof(uapp_mavlinkserhb_param_t));
 
-	if(!mlhbsp->status){
-		__free_page(mlhbsp_page);
-		return false;
+void mavlinkserhb_initialize(u32 baudrate){
+
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
+
+	if(!(pages = mlhb_get_param(&flags))){
+		return;
 	}
 
-	__free_page(mlhbsp_page);
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_INITIALIZE;
+	pages->param->iparam_1 = baudrate;
+
+	mlhb_hvc(pages);
+
+	mlhb_put_param(flags);
 	return;
 }
 
@@ -114,87 +175,51 @@ void mavlinkserhb_initialize(u32 baudrate){
 
 bool mavlinkserhb_send(u8 *buffer, u32 buf_len){
 
-	uapp_mavlinkserhb_param_t *mlhbsp;
-	struct page *mlhbsp_page;
-	u32 mlhbsp_paddr;
-	struct page *buffer_page;
-	u32 buffer_page_paddr;
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
 	//sanity check length
 	if(buf_len > 4096)
 		return false;
 
-	//allocate parameter page
-	mlhbsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!mlhbsp_page){
+	if(!(pages = mlhb_get_param(&flags))){
 		return false;
 	}
 
-	mlhbsp = (uapp_mavlinkserhb_param_t *)page_address(mlhbsp_page);
-
-	//allocate buffer physical page
-	buffer_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!buffer_page){
-		return false;
-	}
-
-	buffer_page_paddr = page_to_phys(buffer_page);
-
-	//copy over buffer contents to buffer physical page
-	memcpy(page_address(buffer_page), buffer, buf_len);
+	//copy over buffer contents to the buffer page of this CPU
+	memcpy(pages->buffer, buffer, buf_len);
 
 	//issue send hypercall
-	mlhbsp->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_SEND;
-	mlhbsp->iparam_1 = buffer_page_paddr;
-	mlhbsp->iparam_2 = buf_len;
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_SEND;
+	pages->param->iparam_1 = pages->buffer_paddr;
+	pages->param->iparam_2 = buf_len;
 
-	mlhbsp_paddr = page_to_phys(mlhbsp_page);
-	__hvc(UAPP_MAVLINKSERHB_UHCALL, mlhbsp_paddr, sizeof(uapp_mavlinkserhb_param_t));
+	status = mlhb_hvc(pages);
 
-	if(!mlhbsp->status){
-		__free_page(mlhbsp_page);
-		__free_page(buffer_page);
-		return false;
-	}
-
-	__free_page(mlhbsp_page);
-	__free_page(buffer_page);
-	return true;
+	mlhb_put_param(flags);
+	return status;
 }
 
 
 
 bool mavlinkserhb_checkrecv(void){
 
-	uapp_mavlinkserhb_param_t *mlhbsp;
-	struct page *mlhbsp_page;
-	u32 mlhbsp_paddr;
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	//allocate parameter page
-	mlhbsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!mlhbsp_page){
+	if(!(pages = mlhb_get_param(&flags))){
 		return false;
 	}
 
-	mlhbsp = (uapp_mavlinkserhb_param_t *)page_address(mlhbsp_page);
-
 	//issue checkrecv hypercall
-	mlhbsp->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_CHECKRECV;
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_CHECKRECV;
 
-	mlhbsp_paddr = page_to_phys(mlhbsp_page);
-	__hvc(UAPP_MAVLINKSERHB_UHCALL, mlhbsp_paddr, sizeof(uapp_mavlinkserhb_param_t));
+	status = mlhb_hvc(pages);
 
-
-	if(!mlhbsp->status){
-		__free_page(mlhbsp_page);
-		return false;
-	}else{
-		__free_page(mlhbsp_page);
-		return true;
-	}
+	mlhb_put_param(flags);
+	return status;
 }
 
 
@@ -202,49 +227,27 @@ bool mavlinkserhb_checkrecv(void){
 
 bool mavlinkserhb_recv(u8 *buffer, u32 max_len, u32 *len_read, bool *uartreadbufexhausted){
 
+	mavlinkserhb_hvc_pages_t *pages;
 	uapp_mavlinkserhb_param_t *mlhbsp;
-	struct page *mlhbsp_page;
-	u32 mlhbsp_paddr;
-	struct page *buffer_page;
-	u32 buffer_page_paddr;
+	unsigned long flags;
 
 	//sanity check length
 	if(max_len > 4096)
 		return false;
 
-	//allocate parameter page
-	mlhbsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!mlhbsp_page){
+	if(!(pages = mlhb_get_param(&flags))){
 		return false;
 	}
+	mlhbsp = pages->param;
 
-	mlhbsp = (uapp_mavlinkserhb_param_t *)page_address(mlhbsp_page);
-
-	//allocate buffer physical page
-	buffer_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-
-	if(!buffer_page){
-		return false;
-	}
-
-	buffer_page_paddr = page_to_phys(buffer_page);
-
-
-	//issue send hypercall
+	//issue recv hypercall into the buffer page of this CPU
 	mlhbsp->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_RECV;
-	mlhbsp->iparam_1 = buffer_page_paddr;
+	mlhbsp->iparam_1 = pages->buffer_paddr;
 	mlhbsp->iparam_2 = max_len;
 
-
-	mlhbsp_paddr = page_to_phys(mlhbsp_page);
-	__hvc(UAPP_MAVLINKSERHB_UHCALL, mlhbsp_paddr, sizeof(uapp_mavlinkserhb_param_t));
-
-
-	if(!mlhbsp->status){
+	if(!mlhb_hvc(pages)){
 		//error
-		__free_page(mlhbsp_page);
-		__free_page(buffer_page);
+		mlhb_put_param(flags);
 		return false;
 	}
 
@@ -258,10 +261,9 @@ bool mavlinkserhb_recv(u8 *buffer, u32 max_len, u32 *len_read, bool *uartreadbuf
 	else
 		*uartreadbufexhausted = false;
 
-	memcpy(buffer, page_address(buffer_page), mlhbsp->oparam_1);
+	memcpy(buffer, pages->buffer, mlhbsp->oparam_1);
 
-	__free_page(mlhbsp_page);
-	__free_page(buffer_page);
+	mlhb_put_param(flags);
 	return true;
 }
 
@@ -269,61 +271,108 @@ bool mavlinkserhb_recv(u8 *buffer, u32 max_len, u32 *len_read, bool *uartreadbuf
 bool mavlinkserhb_activatehbhyptask(u32 first_period, u32 recurring_period,
 		u32 priority){
 
-	uapp_mavlinkserhb_param_t *mlhbsp;
-	struct page *mlhbsp_page;
-	u32 mlhbsp_paddr;
-
-	mlhbsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	if(!mlhbsp_page){
+	if(!(pages = mlhb_get_param(&flags))){
 		return false;
 	}
 
-	mlhbsp = (uapp_mavlinkserhb_param_t *)page_address(mlhbsp_page);
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_ACTIVATEHBHYPTASK;
+	pages->param->iparam_1 = first_period;
+	pages->param->iparam_2 = recurring_period;
+	pages->param->iparam_3 = priority;
+
+	status = mlhb_hvc(pages);
+
+	mlhb_put_param(flags);
+	return status;
+}
+
 
-	mlhbsp->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_ACTIVATEHBHYPTASK;
-	mlhbsp->iparam_1 = first_period;
-	mlhbsp->iparam_2 = recurring_period;
-	mlhbsp->iparam_3 = priority;
+bool mavlinkserhb_registerrxirq(u32 virq){
 
-	mlhbsp_paddr = page_to_phys(mlhbsp_page);
-	__hvc(UAPP_MAVLINKSERHB_UHCALL, mlhbsp_paddr, sizeof(uapp_mavlinkserhb_param_t));
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	if(!mlhbsp->status){
-		__free_page(mlhbsp_page);
+	if(!(pages = mlhb_get_param(&flags))){
 		return false;
 	}
 
-	__free_page(mlhbsp_page);
-	return true;
-}
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_REGISTERRXIRQ;
+	pages->param->iparam_1 = virq;
 
+	status = mlhb_hvc(pages);
 
-bool mavlinkserhb_deactivatehbhyptask(void){
+	mlhb_put_param(flags);
+	return status;
+}
 
-	uapp_mavlinkserhb_param_t *mlhbsp;
-	struct page *mlhbsp_page;
-	u32 mlhbsp_paddr;
 
-	mlhbsp_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+bool mavlinkserhb_registertxbuffer(u32 buffer_paddr, u32 buffer_size){
+
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
 
-	if(!mlhbsp_page){
+	if(!(pages = mlhb_get_param(&flags))){
 		return false;
 	}
 
-	mlhbsp = (uapp_mavlinkserhb_param_t *)page_address(mlhbsp_page);
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_REGISTERTXBUFFER;
+	pages->param->iparam_1 = buffer_paddr;
+	pages->param->iparam_2 = buffer_size;
+
+	status = mlhb_hvc(pages);
+
+	mlhb_put_param(flags);
+	return status;
+}
+
 
-	mlhbsp->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_DEACTIVATEHBHYPTASK;
+bool mavlinkserhb_sendspan(u32 offset, u32 len, u32 *len_sent){
 
-	mlhbsp_paddr = page_to_phys(mlhbsp_page);
-	__hvc(UAPP_MAVLINKSERHB_UHCALL, mlhbsp_paddr, sizeof(uapp_mavlinkserhb_param_t));
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
 
-	if(!mlhbsp->status){
-		__free_page(mlhbsp_page);
+	if(!(pages = mlhb_get_param(&flags))){
 		return false;
 	}
 
-	__free_page(mlhbsp_page);
+	//issue sendspan hypercall on the registered tx buffer (no copy)
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_SENDSPAN;
+	pages->param->iparam_1 = offset;
+	pages->param->iparam_2 = len;
+
+	if(!mlhb_hvc(pages)){
+		mlhb_put_param(flags);
+		return false;
+	}
+
+	//oparam_1 = bytes accepted by the UART
+	*len_sent = pages->param->oparam_1;
+
+	mlhb_put_param(flags);
 	return true;
 }
 
+
+bool mavlinkserhb_deactivatehbhyptask(void){
+
+	mavlinkserhb_hvc_pages_t *pages;
+	unsigned long flags;
+	bool status;
+
+	if(!(pages = mlhb_get_param(&flags))){
+		return false;
+	}
+
+	pages->param->uhcall_fn = UAPP_MAVLINKSERHB_UHCALL_DEACTIVATEHBHYPTASK;
+
+	status = mlhb_hvc(pages);
+
+	mlhb_put_param(flags);
+	return status;
+}
@@ -15,6 +15,7 @@ DM20-0619
 #include <linux/moduleparam.h>
 
 #include <linux/proc_fs.h>
+#include <linux/seq_file.h>
 
 #include <linux/kthread.h>
 #include <linux/syscalls.h>
@@ -25,37 +26,35 @@ DM20-0619
 #include <linux/clocksource.h>
 #include <linux/timekeeping.h>
 #include <linux/delay.h>
+#include <linux/irq_work.h>
+#include <linux/interrupt.h>
+#include <linux/vmalloc.h>
+#include <linux/slab.h>
+#include <linux/log2.h>
+#include <linux/poll.h>
+#include <linux/jump_label.h>
+#include <linux/math64.h>
 
 #include <asm/div64.h>
 
 #include "hypmtscheduler.h"
 
+#include "hypbackend.h"
+
 //externals
-extern  void __hvc(u32 uhcall_function, void *uhcall_buffer, u32 uhcall_buffer_len);
-extern bool hypmtscheduler_createhyptask(u32 first_period, u32 regular_period,
-			u32 priority, u32 hyptask_id, u32 *hyptask_handle);
-extern bool hypmtscheduler_disablehyptask(u32 hyptask_handle);
-extern bool hypmtscheduler_guestjobstart(u32 hyptask_handle);
-extern bool hypmtscheduler_deletehyptask(u32 hyptask_handle);
+#ifdef CONFIG_ARM
 extern u64 sysreg_read_cntpct(void);
-extern bool hypmtscheduler_getrawtick64(u64 *tickcount);
-extern u64 hypmtscheduler_readtsc64(void);
-extern bool hypmtscheduler_inittsc(void);
-extern bool hypmtscheduler_logtsc(u32 event);
-extern bool hypmtscheduler_dumpdebuglog(u8 *dst_log_buffer, u32 *num_entries);
-
-
-//////
-// externals
-//////
-extern  void __hvc(u32 uhcall_function, void *uhcall_buffer, u32 uhcall_buffer_len);
-extern void mavlinkserhb_initialize(u32 baudrate);
-extern bool mavlinkserhb_send(u8 *buffer, u32 buf_len);
-extern bool mavlinkserhb_checkrecv(void);
-extern bool mavlinkserhb_recv(u8 *buffer, u32 max_len, u32 *len_read, bool *uartreadbufexhausted);
-extern bool mavlinkserhb_activatehbhyptask(u32 first_period, u32 recurring_period,
-		u32 priority);
-extern bool mavlinkserhb_deactivatehbhyptask(void);
+#endif
+
+// hypervisor backend (see hypbackend.h): "xmhf" or "sw"
+#ifdef CONFIG_ARM
+static char *hyp_backend = "xmhf";
+#else
+static char *hyp_backend = "sw";
+#endif
+module_param(hyp_backend, charp, 0440);
+
+struct hyp_backend_ops *hypbackend = NULL;
 
 
 hypmtscheduler_logentry_t debug_log[DEBUG_LOG_SIZE];
@@ -64,6 +63,9 @@ u32 debug_log_buffer_index = 0;
 #include "zsrmv.h"
 #include "zsrmvapi.h"
 
+#define CREATE_TRACE_POINTS
+#include "zsrmv_trace.h"
+
 //#define ZSV_SIMULATE_CRASH 1
 
 //#define __ZSV_SECURE_TASK_BOOTSTRAP__ 1
@@ -83,6 +85,30 @@ u32 debug_log_buffer_index = 0;
 static int cts_gpio_pin=GPIO_CTS;
 module_param(cts_gpio_pin, int, 0660);
 
+// drive the releases of reserves with a hyptask from the hypervisor
+// doorbell (raised on hyp_release_irq) instead of a Linux period hrtimer
+static int hyp_driven_release=0;
+module_param(hyp_driven_release, int, 0660);
+static int hyp_release_irq=-1;
+module_param(hyp_release_irq, int, 0660);
+
+// read the hypervisor log from a shared event ring instead of the
+// DUMPDEBUGLOG hypercall (falls back to the hypercall if the
+// hypervisor does not accept the ring)
+static int hyp_event_ring=1;
+module_param(hyp_event_ring, int, 0660);
+
+// wake the serial receiver with the rx interrupt of the mavlinkserhb
+// uberapp (raised on serial_rx_irq). Without it the receiver polls,
+// backing off from serial_rx_poll_min_us to serial_rx_poll_max_us while
+// the UART is idle. With it serial_rx_poll_max_us is only a watchdog.
+static int serial_rx_irq=-1;
+module_param(serial_rx_irq, int, 0660);
+static int serial_rx_poll_min_us=100;
+module_param(serial_rx_poll_min_us, int, 0660);
+static int serial_rx_poll_max_us=2000;
+module_param(serial_rx_poll_max_us, int, 0660);
+
 void serial_stop_transmission(void){
   gpio_set_value(GPIO_RTS, 1);//0);
 }
@@ -97,6 +123,7 @@ int serial_is_reception_stopped(void){
 
 // forward declarations
 void create_hypertask(int rid);
+extern hypmtscheduler_release_doorbell_t *hyp_release_doorbell;
 
 
 //-- ghost variable: the current time
@@ -145,6 +172,21 @@ unsigned long long cumm_departure_ticks=0L;
 unsigned long long num_departures = 0L;
 unsigned long long wc_departure_ticks=0L;
 
+// timer events that found zsrmlock taken (counted from any CPU)
+atomic64_t num_timer_contentions = ATOMIC64_INIT(0);
+atomic64_t num_timer_deferrals = ATOMIC64_INIT(0);
+atomic64_t num_timer_drops = ATOMIC64_INIT(0);
+unsigned long long num_processed_deferrals=0L;
+unsigned long long cumm_deferral_ticks=0L;
+unsigned long long wc_deferral_ticks=0L;
+
+// releases delivered by the hypervisor doorbell
+unsigned long long num_hyp_releases=0L;
+
+// hyptask commands issued in batches (see hyp_cmdq_push())
+unsigned long long num_hyp_batches=0L;
+unsigned long long num_hyp_batched_cmds=0L;
+
 u64 start_tick;
 u64 end_tick;
 
@@ -160,9 +202,12 @@ inline unsigned long long DIV(unsigned long long a, unsigned long long b){
 
 
 /**
- *  Enable use of sys_tsc
+ *  Enable use of sys_tsc (the ARM generic timer counter). Other
+ *  architectures use the raw monotonic clock in ns
  */
+#ifdef CONFIG_ARM
 #define __ZS_USE_SYSTSC__ 1
+#endif
 
 
 /**
@@ -178,8 +223,8 @@ inline unsigned long long DIV(unsigned long long a, unsigned long long b){
 
 /**
  * These functions need to be compiled only on ARM
- * Need to add conditional compilation macros
  */
+#ifdef CONFIG_ARM
 static inline void ccnt_init (void)
 {
     asm volatile ("mcr p15, 0, %0, c15, c12, 0" : : "r" (1));
@@ -245,16 +290,151 @@ u64 rdtsc64(void){
 }
 
 
+#endif // CONFIG_ARM
 /*************** END OF ARM ONLY ***********************/
 
 
 
 /**
  * Trace structures
+ *
+ * One ring of trace records per CPU. The producer is always the local
+ * CPU (with interrupts disabled while it writes) and the consumer is
+ * zsrm_read() or a user-space process with the trace mmap'd. The
+ * rings and their control page (struct zsv_trace_ctl) live in a single
+ * vmalloc_user() area that is mapped in place. head and tail are
+ * free-running counters: the number of records in the ring is
+ * head - tail and the slot of counter c is c & mask. When the ring is
+ * full the producer either drops the new record or, in overwrite mode,
+ * pushes tail forward to discard the oldest one. Both sides advance
+ * tail with cmpxchg so a consumer that raced with an overwrite
+ * discards the record it copied.
  */
-#define TRACE_BUFFER_SIZE 100000
-struct trace_rec_t trace_table[TRACE_BUFFER_SIZE];
-int trace_index=0;
+#define DEFAULT_TRACE_BUFFER_SIZE 32768
+
+// records per CPU (rounded up to a power of two)
+static int trace_buffer_size=DEFAULT_TRACE_BUFFER_SIZE;
+module_param(trace_buffer_size, int, 0440);
+// 1: overwrite the oldest records when full, 0: drop the new ones
+static int trace_overwrite=1;
+module_param(trace_overwrite, int, 0440);
+
+struct trace_ring {
+  struct trace_rec_t *recs;
+  unsigned int mask;
+  struct zsv_trace_ring_ctl *ctl;
+};
+
+struct trace_ring trace_rings[NR_CPUS];
+void *trace_area = NULL;
+unsigned long trace_area_size = 0;
+
+/*
+ * Readers blocked in poll() are woken up when the trace holds at least
+ * trace_watermark records (SET_TRACE_WATERMARK). add_trace_record() can
+ * run with scheduler locks held so the wakeup is deferred to irq_work.
+ * zsrm_poll() sets trace_waiters_pending before it checks the trace
+ * size so add_trace_record() only looks at the wait queue (and the
+ * size) while a reader may be blocked. add_trace_record() has no
+ * barrier between publishing a record and reading the flag, so a
+ * record racing with the flag can miss it: before it blocks, the
+ * reader sends an IPI to the other CPUs (trace_poll_sync()), after
+ * which their records are visible, and checks the size again.
+ */
+static DECLARE_WAIT_QUEUE_HEAD(trace_wait_queue);
+struct irq_work trace_wakeup_work;
+unsigned int trace_watermark = 1;
+int trace_waiters_pending = 0;
+
+static void trace_wakeup_handler(struct irq_work *work)
+{
+  wake_up_interruptible(&trace_wait_queue);
+}
+
+// empty IPI: once it ran, the records of that CPU are visible
+static void trace_poll_sync(void *info)
+{
+}
+
+int init_trace_rings(void)
+{
+  int cpu;
+  unsigned int size;
+  unsigned long ring_bytes;
+  unsigned long ctl_bytes;
+  struct zsv_trace_ctl *ctl;
+
+  if (trace_buffer_size <= 0)
+    trace_buffer_size = DEFAULT_TRACE_BUFFER_SIZE;
+  size = roundup_pow_of_two(trace_buffer_size);
+  ring_bytes = PAGE_ALIGN(size * sizeof(struct trace_rec_t));
+  ctl_bytes = PAGE_ALIGN(sizeof(struct zsv_trace_ctl) + nr_cpu_ids * sizeof(struct zsv_trace_ring_ctl));
+
+  trace_area_size = ctl_bytes + nr_cpu_ids * ring_bytes;
+  trace_area = vmalloc_user(trace_area_size);
+  if (trace_area == NULL){
+    printk("ZSRMV.init_trace_rings(): could not allocate %lu bytes for the trace\n",trace_area_size);
+    return -ENOMEM;
+  }
+
+  ctl = (struct zsv_trace_ctl *) trace_area;
+  ctl->version = ZSV_TRACE_VERSION;
+  ctl->num_cpus = nr_cpu_ids;
+  ctl->map_size = trace_area_size;
+  ctl->rec_size = sizeof(struct trace_rec_t);
+
+  for_each_possible_cpu(cpu){
+    trace_rings[cpu].ctl = &ctl->ring[cpu];
+    trace_rings[cpu].ctl->size = size;
+    trace_rings[cpu].ctl->offset = ctl_bytes + cpu * ring_bytes;
+    trace_rings[cpu].recs = (struct trace_rec_t *)((char *)trace_area + trace_rings[cpu].ctl->offset);
+    trace_rings[cpu].mask = size - 1;
+  }
+
+  init_irq_work(&trace_wakeup_work, trace_wakeup_handler);
+  return 0;
+}
+
+void free_trace_rings(void)
+{
+  if (trace_area != NULL){
+    vfree(trace_area);
+    trace_area = NULL;
+  }
+}
+
+// number of records in all the rings
+unsigned long trace_size(void)
+{
+  int cpu;
+  unsigned long size=0;
+
+  for_each_possible_cpu(cpu){
+    size += READ_ONCE(trace_rings[cpu].ctl->head) - READ_ONCE(trace_rings[cpu].ctl->tail);
+  }
+  return size;
+}
+
+/*
+ * Remove the oldest record of ring copying it to rec. Returns 0 if the
+ * ring is empty.
+ */
+int trace_ring_consume(struct trace_ring *ring, struct trace_rec_t *rec)
+{
+  unsigned int tail;
+
+  while(1){
+    tail = READ_ONCE(ring->ctl->tail);
+    if (tail == READ_ONCE(ring->ctl->head))
+      return 0;
+    smp_rmb();
+    *rec = ring->recs[tail & ring->mask];
+    smp_rmb();
+    if (cmpxchg(&ring->ctl->tail, tail, tail+1) == tail)
+      return 1;
+    // overwritten while we copied it: try the new oldest record
+  }
+}
 
 
 
@@ -298,6 +478,7 @@ int calling_stop_from=0;
 // OTHER LOCKING SITUATIONS
 #define SCHED_TASK 5
 #define ZSV_CALL   6
+#define PENDING_EVENTS 7
 
 #define STRING_TIMER_TYPE(t) ( t == TIMER_ENF ? "timer_enf" :\
 			       t == TIMER_PERIOD ? "timer_period" :\
@@ -313,6 +494,7 @@ int zsrmcall=-1;
 			   t == TIMER_ZS_ENF ? "timer_zs_enf" :	    \
 			   t == SCHED_TASK   ? "sched_task" : \
 			   t == ZSV_CALL     ? "zsv_call"  :\
+			   t == PENDING_EVENTS ? "pending_events" : \
 			   t == 0            ? "none" : \
 			   "unknown")
 
@@ -340,6 +522,18 @@ unsigned long long serial_debug_before_sleep_timestamp_ticks=0L;
 unsigned long long serial_debug_after_sleep_timestamp_ticks=0L;
 unsigned long long serial_debug_sleep_elapsed_interval_ticks=0L;
 
+// serial receiver wakeups and rx interrupt to receiver latency
+int serial_rx_irq_active=0;
+atomic_t serial_rx_irq_pending = ATOMIC_INIT(0);
+unsigned long long serial_rx_irq_timestamp_ticks=0L;
+int serial_rx_poll_us=0;
+unsigned long long num_serial_rx_wakeups=0L;
+unsigned long long num_serial_rx_empty_wakeups=0L;
+unsigned long long num_serial_rx_irqs=0L;
+unsigned long long num_serial_rx_irq_wakeups=0L;
+unsigned long long cumm_serial_rx_latency_ticks=0L;
+unsigned long long wc_serial_rx_latency_ticks=0L;
+
 #define SERIAL_FLAG_RCV_READ_BLOCKED 1
 #define SERIAL_FLAG_SND_READ_BLOCKED 2
 #define SERIAL_FLAG_HWR_RCV_BLOCKED 4
@@ -380,6 +574,10 @@ void budget_enforcement(int rid, int request_stop);
 void start_of_period(int rid);
 int timer_handler(struct zs_timer *timer);
 int add_timerq(struct zs_timer *t);
+int arm_absolute_timer(struct zs_timer *timer, unsigned long long abs_expiration_ns, unsigned long long slack_ns);
+unsigned long long job_release_ns(int rid, unsigned long long job);
+int add_zs_timerq(struct zs_timer *t, unsigned long long release_ns);
+int del_zs_timerq(struct zs_timer *t);
 int attach_reserve(int rid, int pid);
 int start_enforcement_timer(struct reserve *rsvp);
 void start_stac(int rid);
@@ -395,6 +593,7 @@ int push_to_reschedule(int i);
 int pop_to_reschedule(void);
 void init(void);
 enum hrtimer_restart kernel_timer_handler(struct hrtimer *timer);
+enum hrtimer_restart zs_timerq_handler(struct hrtimer *timer);
 unsigned long long ticks2ns(unsigned long long ticks);
 unsigned long long ticks2ns1(unsigned long long ticks);
 unsigned long long ns2ticks(unsigned long long ns);
@@ -403,7 +602,7 @@ int get_acet_ns(int rid, unsigned long long *avet);
 int get_wcet_ns(int rid, unsigned long long *wcet);
 void reset_exectime_counters(int rid);
 int delete_reserve(int rid);
-int add_trace_record(int rid, unsigned long long ts, int event_type);
+int valid_rid(int rid);
 int in_readyq(int rid);
 int push_to_activate(int i);
 int pop_to_activate(void);
@@ -737,8 +936,285 @@ void __xchg_wrong_size(void);
 //-- ZSRM functions
 /*********************************************************************/
 
-int add_trace_record(int rid, unsigned long long ts, int event_type)
+/*
+ * Trace filter (SET_TRACE_FILTER). trace_enabled_key is disabled when
+ * no event type is selected and trace_filter_key is only enabled when
+ * the filter drops something, so the default trace and a disabled
+ * trace cost a patched branch at each add_trace_record() call.
+ */
+DEFINE_STATIC_KEY_TRUE(trace_enabled_key);
+DEFINE_STATIC_KEY_FALSE(trace_filter_key);
+struct zsv_trace_filter trace_filter = {
+  .event_mask = ZSV_TRACE_ALL_EVENTS,
+  .rid_mask = { [0 ... ZSV_TRACE_MAX_RIDS/32-1] = ~0U },
+};
+
+// event types or rids outside the masks are always recorded
+static inline int trace_filter_match(int rid, int event_type)
+{
+  if (event_type >= 0 && event_type < 64 &&
+      !(READ_ONCE(trace_filter.event_mask) & (1ULL << event_type)))
+    return 0;
+  if (rid >= 0 && rid < ZSV_TRACE_MAX_RIDS &&
+      !(READ_ONCE(trace_filter.rid_mask[rid / 32]) & (1U << (rid % 32))))
+    return 0;
+  return 1;
+}
+
+/*
+ * Called from process context without zsrmlock: toggling static keys
+ * patches code and can sleep.
+ */
+int set_trace_filter(struct api_call *call)
+{
+  struct zsv_trace_filter filter;
+  int i, all=1;
+
+  if (call->buf_len != sizeof(filter) ||
+      copy_from_user(&filter, call->buffer, sizeof(filter))){
+    printk("ZSRMMV.set_trace_filter(): ERROR invalid filter\n");
+    return -1;
+  }
+
+  for (i=0;i<ZSV_TRACE_MAX_RIDS/32;i++){
+    WRITE_ONCE(trace_filter.rid_mask[i], filter.rid_mask[i]);
+    if (filter.rid_mask[i] != ~0U)
+      all = 0;
+  }
+  WRITE_ONCE(trace_filter.event_mask, filter.event_mask);
+  if (filter.event_mask != ZSV_TRACE_ALL_EVENTS)
+    all = 0;
+
+  if (all)
+    static_branch_disable(&trace_filter_key);
+  else
+    static_branch_enable(&trace_filter_key);
+
+  if (filter.event_mask == 0)
+    static_branch_disable(&trace_enabled_key);
+  else
+    static_branch_enable(&trace_enabled_key);
+
+  return 0;
+}
+
+int __add_trace_record(int rid, unsigned long long ts, int event_type);
+
+/*
+ * Emit the Linux tracepoint of a scheduler event (see zsrmv_trace.h).
+ * event_type is a constant at the call sites so this folds into a
+ * single tracepoint, which is a patched branch while it is disabled.
+ */
+static __always_inline void zsrmv_tracepoint(int rid, unsigned long long ts, int event_type)
+{
+  struct reserve *rsv = (rid >= 0 && rid < MAX_RESERVES) ? &reserve_table[rid] : NULL;
+
+  switch(event_type){
+  case TRACE_EVENT_WFNP: trace_zsrmv_wait_period(rsv, rid, ts); break;
+  case TRACE_EVENT_START_PERIOD: trace_zsrmv_start_period(rsv, rid, ts); break;
+  case TRACE_EVENT_PREEMPTED: trace_zsrmv_preempted(rsv, rid, ts); break;
+  case TRACE_EVENT_RESUMED: trace_zsrmv_resumed(rsv, rid, ts); break;
+  case TRACE_EVENT_BUDGET_ENFORCEMENT: trace_zsrmv_budget_enforced(rsv, rid, ts); break;
+  case TRACE_EVENT_DONT_WFNP: trace_zsrmv_dont_wait_period(rsv, rid, ts); break;
+  case TRACE_EVENT_IDLE: trace_zsrmv_idle(rsv, rid, ts); break;
+  case TRACE_EVENT_END_PERIOD: trace_zsrmv_end_period(rsv, rid, ts); break;
+  case TRACE_EVENT_WAIT_RELEASE: trace_zsrmv_wait_release(rsv, rid, ts); break;
+  case TRACE_EVENT_WAIT_RELEASE_BLOCKED: trace_zsrmv_wait_release_blocked(rsv, rid, ts); break;
+  case TRACE_EVENT_WAIT_RELEASE_NOT_BLOCKED: trace_zsrmv_wait_release_not_blocked(rsv, rid, ts); break;
+  case TRACE_EVENT_START_PERIOD_PERIODIC_WAIT: trace_zsrmv_start_period_periodic_wait(rsv, rid, ts); break;
+  case TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_WAKEUP: trace_zsrmv_start_period_non_periodic_wait_wakeup(rsv, rid, ts); break;
+  case TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_NO_WAKEUP: trace_zsrmv_start_period_non_periodic_wait_no_wakeup(rsv, rid, ts); break;
+  case TRACE_EVENT_ZERO_SLACK: trace_zsrmv_zero_slack(rsv, rid, ts); break;
+  }
+}
+
+static inline void zsrmv_hyp_tracepoint(hypmtscheduler_logentry_t *entry)
+{
+  switch(entry->event_type){
+  case DEBUG_LOG_EVTTYPE_CREATEHYPTASK_BEFORE: trace_zsrmv_hyp_createhyptask_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_CREATEHYPTASK_AFTER: trace_zsrmv_hyp_createhyptask_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_DISABLEHYPTASK_BEFORE: trace_zsrmv_hyp_disablehyptask_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_DISABLEHYPTASK_AFTER: trace_zsrmv_hyp_disablehyptask_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_DELETEHYPTASK_BEFORE: trace_zsrmv_hyp_deletehyptask_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_DELETEHYPTASK_AFTER: trace_zsrmv_hyp_deletehyptask_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_INITTSC_BEFORE: trace_zsrmv_hyp_inittsc_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_INITTSC_AFTER: trace_zsrmv_hyp_inittsc_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE: trace_zsrmv_hyp_hyptaskexec_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_HYPTASKEXEC_AFTER: trace_zsrmv_hyp_hyptaskexec_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_HANDLEHCALL_BEFORE: trace_zsrmv_hyp_handlehcall_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_HANDLEHCALL_AFTER: trace_zsrmv_hyp_handlehcall_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_SCHEDLOGIC_BEFORE: trace_zsrmv_hyp_schedlogic_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_SCHEDLOGIC_AFTER: trace_zsrmv_hyp_schedlogic_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_TIMERHANDLER_BEFORE: trace_zsrmv_hyp_timerhandler_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_TIMERHANDLER_AFTER_NOTIMERSEXPIRED: trace_zsrmv_hyp_timerhandler_after_notimersexpired(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_TIMERHANDLER_AFTER_TIMEREXPIREDINHYP: trace_zsrmv_hyp_timerhandler_after_timerexpiredinhyp(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_TIMERHANDLER_AFTER_TIMEREXPIREDGOTOSCHEDLOGIC: trace_zsrmv_hyp_timerhandler_after_timerexpiredgotoschedlogic(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_PHYSTIMERPROGRAM_TIMERHANDLER: trace_zsrmv_hyp_phystimerprogram_timerhandler(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_PHYSTIMERPROGRAM_UNDECLARE: trace_zsrmv_hyp_phystimerprogram_undeclare(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_PHYSTIMERPROGRAM_INSTANTIATESHORTEST: trace_zsrmv_hyp_phystimerprogram_instantiateshortest(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_PHYSTIMERPROGRAM_INSTANTIATESHORTER: trace_zsrmv_hyp_phystimerprogram_instantiateshorter(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_STARTGUESTJOB_BEFORE: trace_zsrmv_hyp_startguestjob_before(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_STARTGUESTJOB_AFTER: trace_zsrmv_hyp_startguestjob_after(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_DISABLEHYPTASK_INVALID_START: trace_zsrmv_hyp_disablehyptask_invalid_start(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_FIRST_PERIOD_PARAM: trace_zsrmv_hyp_first_period_param(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_REGULAR_PERIOD_PARAM: trace_zsrmv_hyp_regular_period_param(entry->hyptask_id, entry->timestamp); break;
+  case DEBUG_LOG_EVTTYPE_INVALID_START_NUM_PERIOD_OFFSET: trace_zsrmv_hyp_invalid_start_num_period_offset(entry->hyptask_id, entry->timestamp); break;
+  default: trace_zsrmv_hyp_other(entry->hyptask_id, entry->timestamp, entry->event_type); break;
+  }
+}
+
+static __always_inline int add_trace_record(int rid, unsigned long long ts, int event_type)
+{
+  zsrmv_tracepoint(rid, ts, event_type);
+
+  if (!static_branch_likely(&trace_enabled_key))
+    return 0;
+  if (static_branch_unlikely(&trace_filter_key) && !trace_filter_match(rid, event_type))
+    return 0;
+  return __add_trace_record(rid, ts, event_type);
+}
+
+static inline int add_hyp_trace_record(hypmtscheduler_logentry_t *entry)
+{
+  zsrmv_hyp_tracepoint(entry);
+  return add_trace_record(entry->hyptask_id, entry->timestamp, entry->event_type);
+}
+
+/*
+ * Charge the execution of a hyptask (a HYPTASKEXEC_BEFORE entry
+ * immediately followed by its HYPTASKEXEC_AFTER) as preemption to every
+ * other reserve whose current job was active when it started.
+ */
+void account_hyp_preemption(int hyptask_id, unsigned long long start_ticks, unsigned long long duration_ticks)
+{
+  struct reserve *rsv;
+  int i;
+
+  for (i=0;i<MAX_RESERVES;i++){
+    rsv = &reserve_table[i];
+    if (!rsv->attached || i == hyptask_id ||
+	start_ticks < rsv->current_job_activation_ticks)
+      continue;
+    if (rsv->hyp_preemption_job_ticks != rsv->current_job_activation_ticks){
+      rsv->hyp_preemption_job_ticks = rsv->current_job_activation_ticks;
+      rsv->hyp_preemption_ticks = 0L;
+    }
+    rsv->hyp_preemption_ticks += duration_ticks;
+  }
+}
+
+// serializes the consumers of the hypervisor log (the event ring tail,
+// hyp_exec_before and the accumulators fed by ingest_hyp_log_entry())
+DEFINE_RAW_SPINLOCK(hyp_ingest_lock);
+
+// last HYPTASKEXEC_BEFORE ingested, waiting for its AFTER
+hypmtscheduler_logentry_t hyp_exec_before;
+int hyp_exec_before_valid=0;
+
+// event ring shared with the hypervisor (NULL if not registered)
+hypmtscheduler_event_ring_t *hyp_event_ring_area = NULL;
+struct page *hyp_event_ring_pages = NULL;
+unsigned long long num_hyp_ring_entries = 0L;
+
+/*
+ * Copy one hypervisor log entry into the trace, the last hyptask start
+ * event of each reserve (see calculate_start_time()) and the hyptask
+ * preemption accumulators.
+ */
+void ingest_hyp_log_entry(hypmtscheduler_logentry_t *entry)
+{
+  add_hyp_trace_record(entry);
+
+  if ((entry->event_type == DEBUG_LOG_EVTTYPE_CREATEHYPTASK_BEFORE ||
+       entry->event_type == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE) &&
+      valid_rid(entry->hyptask_id) &&
+      (reserve_table[entry->hyptask_id].hyp_last_start_event == 0 ||
+       entry->timestamp >= reserve_table[entry->hyptask_id].hyp_last_start_ticks)){
+    reserve_table[entry->hyptask_id].hyp_last_start_ticks = entry->timestamp;
+    reserve_table[entry->hyptask_id].hyp_last_start_event = entry->event_type;
+  }
+
+  if (entry->event_type == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_AFTER && hyp_exec_before_valid){
+    account_hyp_preemption(hyp_exec_before.hyptask_id, hyp_exec_before.timestamp,
+			   entry->timestamp - hyp_exec_before.timestamp);
+    hyp_exec_before_valid = 0;
+    return;
+  }
+  hyp_exec_before_valid = (entry->event_type == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE);
+  hyp_exec_before = *entry;
+}
+
+/*
+ * Consume the entries the hypervisor appended to the event ring since
+ * the last call. Only plain loads: the acquire of head orders the
+ * reads of the entries after it and the release of tail hands the
+ * slots back to the hypervisor once they have been read. Called with
+ * hyp_ingest_lock held, the kernel side being the only writer of tail.
+ */
+int ingest_hyp_event_ring(void)
+{
+  hypmtscheduler_event_ring_t *ring = hyp_event_ring_area;
+  unsigned int head, tail;
+  int n=0;
+
+  head = smp_load_acquire(&ring->head);
+  tail = ring->tail;
+
+  if (head - tail > HYPMTSCHEDULER_EVENT_RING_ENTRIES){
+    // a misbehaving producer: skip to the newest entries
+    printk("ZSRMV.ingest_hyp_event_ring(): head(%u) tail(%u) out of range\n",head, tail);
+    tail = head - HYPMTSCHEDULER_EVENT_RING_ENTRIES;
+  }
+
+  for (; tail != head; tail++, n++){
+    ingest_hyp_log_entry(&ring->entry[tail & (HYPMTSCHEDULER_EVENT_RING_ENTRIES - 1)]);
+  }
+
+  smp_store_release(&ring->tail, tail);
+  num_hyp_ring_entries += n;
+  return n;
+}
+
+/*
+ * Import the new hypervisor log entries, from the event ring when it is
+ * registered or else with the DUMPDEBUGLOG hypercall. Each entry is
+ * processed once so the cost of enforcement does not depend on the size
+ * of the trace, and the accounting does not depend on the trace being
+ * enabled. Budget enforcement, the start time calculation and the
+ * trace reader all call it, possibly at the same time from different
+ * CPUs. Returns the number of entries or -1 if the hypercall failed.
+ */
+int ingest_hyp_debug_log(void)
+{
+  unsigned long flags;
+  int i, n;
+
+  raw_spin_lock_irqsave(&hyp_ingest_lock, flags);
+
+  if (hyp_event_ring_area != NULL){
+    n = ingest_hyp_event_ring();
+  } else {
+    //zero-initialize debug_log
+    memset(&debug_log, 0, sizeof(debug_log));
+    n = -1;
+    if(hypbackend->dumpdebuglog((u8 *)&debug_log, &debug_log_buffer_index)){
+      for (i = 0; i< debug_log_buffer_index; i++){
+	ingest_hyp_log_entry(&debug_log[i]);
+      }
+      n = debug_log_buffer_index;
+    }
+  }
+
+  raw_spin_unlock_irqrestore(&hyp_ingest_lock, flags);
+  return n;
+}
+
+int __add_trace_record(int rid, unsigned long long ts, int event_type)
 {
+  struct trace_ring *ring;
+  unsigned long flags;
+  unsigned int head, tail;
+  struct trace_rec_t *rec;
 #ifdef ZSV_SIMULATE_CRASH
   char buf[100];
 #endif
@@ -758,19 +1234,44 @@ int add_trace_record(int rid, unsigned long long ts, int event_type)
 
 /* #else */
 
-  if (trace_index >= TRACE_BUFFER_SIZE)
-    return -1;
+  local_irq_save(flags);
+  ring = &trace_rings[smp_processor_id()];
+  head = ring->ctl->head;
+  tail = READ_ONCE(ring->ctl->tail);
+
+  if (head - tail > ring->mask){
+    if (!trace_overwrite){
+      ring->ctl->lost++;
+      local_irq_restore(flags);
+      return -1;
+    }
+    // discard the oldest record unless the consumer just took it
+    if (cmpxchg(&ring->ctl->tail, tail, tail+1) == tail)
+      ring->ctl->lost++;
+  }
 
-  trace_table[trace_index].timestamp_ns = ts;
-  trace_table[trace_index].event_type = event_type;
-  trace_table[trace_index].rid = rid;
-  trace_index++;
+  rec = &ring->recs[head & ring->mask];
+  rec->timestamp_ns = ts;
+  rec->event_type = event_type;
+  rec->rid = rid;
+  smp_wmb();
+  WRITE_ONCE(ring->ctl->head, head+1);
+  local_irq_restore(flags);
+
+  // the local ring alone may reach the watermark: only sum the rings
+  // of all CPUs if it does not
+  if (unlikely(READ_ONCE(trace_waiters_pending)) &&
+      (head + 1 - READ_ONCE(ring->ctl->tail) >= READ_ONCE(trace_watermark) ||
+       trace_size() >= READ_ONCE(trace_watermark))){
+    WRITE_ONCE(trace_waiters_pending, 0);
+    irq_work_queue(&trace_wakeup_work);
+  }
 
 #ifdef ZSV_SIMULATE_CRASH
   // Do not print the hypervisor trace events -- they will be printed from the hypervisor
   if (event_type < 50){
     sprintf(buf,"%d 0x%llx 0x%x\n",rid,ts,event_type);
-    mavlinkserhb_send(buf,strlen(buf));
+    hypbackend->serial_send(buf,strlen(buf));
   }
 #endif
 
@@ -819,6 +1320,7 @@ int arm_relative_timer(struct zs_timer *timer)
 
   /* hrtimer_init(&(timer->kernel_timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL); */
   timer->kernel_timer.function= kernel_timer_handler;
+  timer->arm_generation++;
   hrtimer_start(&(timer->kernel_timer), ktime, HRTIMER_MODE_REL);
 
   //-- update ghost variables
@@ -859,6 +1361,201 @@ int add_timerq(struct zs_timer *t)
   return arm_relative_timer(t);
 }
 
+/*
+ * Cancel timer and discard its expiration if it was already deferred.
+ * The generation is bumped after hrtimer_cancel() returns so that a
+ * handler still running on another CPU defers with the old one.
+ */
+void cancel_zs_timer(struct zs_timer *timer)
+{
+  hrtimer_cancel(&(timer->kernel_timer));
+  timer->arm_generation++;
+}
+
+/*
+ * Arm timer to expire at the absolute CLOCK_MONOTONIC instant
+ * abs_expiration_ns. Unlike add_timerq() the expiration does not
+ * depend on when this code runs, so the timers of a reserve do not
+ * drift from its releases. The timer may expire up to slack_ns late
+ * to be coalesced with other timers.
+ */
+int arm_absolute_timer(struct zs_timer *timer, unsigned long long abs_expiration_ns, unsigned long long slack_ns)
+{
+  timer->kernel_timer.function= kernel_timer_handler;
+  timer->arm_generation++;
+  hrtimer_start_range_ns(&(timer->kernel_timer), ns_to_ktime(abs_expiration_ns), slack_ns, HRTIMER_MODE_ABS);
+
+  //-- update ghost variables
+#ifdef STAC_FRAMAC_STUBS
+  timer->stac_armed = 1;
+  timer->stac_expiration_ns = abs_expiration_ns;
+  timer->stac_handler = timer->kernel_timer.function;
+#endif
+
+  return 0;
+}
+
+/*
+ * Nominal release of the job-th job of reserve rid (the first job is
+ * job zero).
+ */
+unsigned long long job_release_ns(int rid, unsigned long long job)
+{
+  return reserve_table[rid].first_job_activation_ns +
+    (reserve_table[rid].period.tv_sec * 1000000000L + reserve_table[rid].period.tv_nsec) * job;
+}
+
+/*********************************************************************/
+//-- Zero-slack timer queue
+//--
+//-- Zero-slack instants of all reserves are kept in a per-CPU min-heap
+//-- ordered by absolute expiration. Only the earliest instant of each
+//-- CPU is programmed in a hardware timer, so re-arming or cancelling
+//-- a zero-slack instant costs O(log n) heap operations and, at most,
+//-- one hrtimer reprogramming when the head of the queue changes.
+//-- All queue operations are done with zsrmlock held.
+/*********************************************************************/
+
+struct zs_timerq {
+  struct zs_timer *heap[MAX_RESERVES];
+  int size;
+  int in_handler;
+  unsigned long long programmed_ns;
+  struct hrtimer kernel_timer;
+};
+
+struct zs_timerq zs_timerq_table[NR_CPUS];
+
+static void zs_timerq_swap(struct zs_timerq *q, int i, int j)
+{
+  struct zs_timer *t = q->heap[i];
+
+  q->heap[i] = q->heap[j];
+  q->heap[j] = t;
+  q->heap[i]->timerq_index = i;
+  q->heap[j]->timerq_index = j;
+}
+
+static void zs_timerq_sift_up(struct zs_timerq *q, int i)
+{
+  while (i > 0 &&
+	 q->heap[i]->timerq_expiration_ns < q->heap[(i-1)/2]->timerq_expiration_ns){
+    zs_timerq_swap(q, i, (i-1)/2);
+    i = (i-1)/2;
+  }
+}
+
+static void zs_timerq_sift_down(struct zs_timerq *q, int i)
+{
+  int l, r, smallest;
+
+  while(1){
+    l = 2*i+1;
+    r = 2*i+2;
+    smallest = i;
+    if (l < q->size &&
+	q->heap[l]->timerq_expiration_ns < q->heap[smallest]->timerq_expiration_ns)
+      smallest = l;
+    if (r < q->size &&
+	q->heap[r]->timerq_expiration_ns < q->heap[smallest]->timerq_expiration_ns)
+      smallest = r;
+    if (smallest == i)
+      break;
+    zs_timerq_swap(q, i, smallest);
+    i = smallest;
+  }
+}
+
+/*
+ * Program the hardware timer of the queue with the earliest instant.
+ * While the queue handler is running the reprogramming is deferred
+ * to the handler exit.
+ */
+void zs_timerq_program(struct zs_timerq *q)
+{
+  if (q->in_handler)
+    return;
+
+  if (q->size == 0){
+    if (q->programmed_ns != 0){
+      hrtimer_try_to_cancel(&(q->kernel_timer));
+      q->programmed_ns = 0;
+    }
+    return;
+  }
+
+  if (q->programmed_ns != q->heap[0]->timerq_expiration_ns){
+    q->programmed_ns = q->heap[0]->timerq_expiration_ns;
+    hrtimer_start_range_ns(&(q->kernel_timer), ns_to_ktime(q->programmed_ns),
+			   q->heap[0]->timerq_slack_ns, HRTIMER_MODE_ABS);
+  }
+}
+
+int del_zs_timerq(struct zs_timer *t)
+{
+  struct zs_timerq *q;
+  struct zs_timer *moved;
+  int i, last;
+
+  if (t->timerq_index < 0)
+    return 0;
+
+  q = &zs_timerq_table[t->timerq_cpu];
+  i = t->timerq_index;
+  last = --q->size;
+
+  if (i != last){
+    moved = q->heap[last];
+    q->heap[i] = moved;
+    moved->timerq_index = i;
+    zs_timerq_sift_up(q, i);
+    zs_timerq_sift_down(q, moved->timerq_index);
+  }
+  q->heap[last] = NULL;
+  t->timerq_index = -1;
+
+  zs_timerq_program(q);
+
+  return 0;
+}
+
+/*
+ * Queue the zero-slack timer t to expire t->expiration after the job
+ * release release_ns. If t was already queued it is moved to its new
+ * position. With timer slack the instant is queued slack earlier so it
+ * fires within [zero-slack - slack, zero-slack] and never late.
+ */
+int add_zs_timerq(struct zs_timer *t, unsigned long long release_ns)
+{
+  struct zs_timerq *q;
+  unsigned long long expiration_ns;
+
+  if (t->timerq_index >= 0)
+    del_zs_timerq(t);
+
+  expiration_ns = t->expiration.tv_sec * 1000000000L + t->expiration.tv_nsec;
+  t->absolute_expiration_ns = expiration_ns;
+  t->timerq_slack_ns = reserve_table[t->rid].timer_slack_ns;
+  if (t->timerq_slack_ns > expiration_ns)
+    t->timerq_slack_ns = expiration_ns;
+  t->timerq_expiration_ns = release_ns + expiration_ns - t->timerq_slack_ns;
+  t->timerq_cpu = smp_processor_id();
+  q = &zs_timerq_table[t->timerq_cpu];
+
+  if (q->size >= MAX_RESERVES){
+    printk("ZSRMMV.add_zs_timerq(rid=%d) ERROR: zero-slack timer queue full\n",t->rid);
+    return -1;
+  }
+
+  t->timerq_index = q->size;
+  q->heap[q->size++] = t;
+  zs_timerq_sift_up(q, t->timerq_index);
+
+  zs_timerq_program(q);
+
+  return 0;
+}
+
 int add_crit_blocked(struct reserve *r){
   r->crit_block_next = NULL;
   if (crit_blockq == NULL){
@@ -1250,49 +1947,28 @@ int send_budget_enforcement_signal(struct task_struct *task, int signo, int rid)
 
 
 unsigned long long calculate_start_time(int rid){
-  int i;
   unsigned long long start_ticks=0L;
-  int eventtype=0;
   unsigned long long now_ticks=0L;
+  unsigned long long period_ticks = reserve_table[rid].period_ticks;
 
   now_ticks = get_now_ticks();
 
-  if(!hypmtscheduler_dumpdebuglog(&debug_log, &debug_log_buffer_index)){
-    printk(KERN_INFO "ZSRMV.budget_enforcement(): dumpdebuglog hypercall API failed\n");
-  } else {
-    //printk(KERN_INFO "ZSRMV.budget_enforcement(): dumpdebuglog: total entries=%u\n", debug_log_buffer_index);
-    for (i = 0; i< debug_log_buffer_index; i++){
-      add_trace_record(debug_log[i].hyptask_id, debug_log[i].timestamp, debug_log[i].event_type);
-    }
-  }
-
-  for (i=0;i<trace_index;i++){
-    if (trace_table[i].rid == rid){
-      if (trace_table[i].event_type == DEBUG_LOG_EVTTYPE_CREATEHYPTASK_BEFORE ||
-	  trace_table[i].event_type == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE ){
-	start_ticks = trace_table[i].timestamp_ns ;
-	eventtype = trace_table[i].event_type;
-      }
-    }
+  if(ingest_hyp_debug_log() < 0){
+    printk(KERN_INFO "ZSRMV.calculate_start_time(): dumpdebuglog hypercall API failed\n");
   }
 
-
-  if (eventtype != 0){
-    if (trace_table[i].event_type == DEBUG_LOG_EVTTYPE_CREATEHYPTASK_BEFORE){
-      start_ticks += reserve_table[rid].period_ticks;
-    } else if (trace_table[i].event_type == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE){
-      start_ticks += (reserve_table[rid].period_ticks - reserve_table[rid].hyp_enforcer_instant_ticks);
+  // latest start event of the hyptask (kept by ingest_hyp_debug_log())
+  if (reserve_table[rid].hyp_last_start_event != 0){
+    start_ticks = reserve_table[rid].hyp_last_start_ticks;
+    if (reserve_table[rid].hyp_last_start_event == DEBUG_LOG_EVTTYPE_CREATEHYPTASK_BEFORE){
+      start_ticks += period_ticks;
+    } else if (reserve_table[rid].hyp_last_start_event == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE){
+      start_ticks += (period_ticks - reserve_table[rid].hyp_enforcer_instant_ticks);
     }
 
-    i=0;
     // forward the clock up to next period in the future
-    while(start_ticks <= now_ticks){
-      start_ticks += reserve_table[rid].period_ticks;
-      // just for protecting against infinite loop
-      if (i++>100){
-	printk("ZSRM.calculate_start_time(): POTENTIAL INFINITE LOOP start(%llu) now(%llu) \n",start_ticks, now_ticks);
-	break;
-      }
+    if (start_ticks <= now_ticks && period_ticks > 0){
+      start_ticks += (DIV(now_ticks - start_ticks, period_ticks) + 1) * period_ticks;
     }
   } else {
     printk("ZSRM.calculate_start_time(): NO HYPTASK EVENTS!!\n");
@@ -1302,24 +1978,19 @@ unsigned long long calculate_start_time(int rid){
   return start_ticks;
 }
 
-unsigned long long calculate_hypertask_preemption_time_ticks(int rid, unsigned long long now_ticks){
-  int i;
-  unsigned long long cumm_hyppreemption_ticks=0L;
-
-
-  // find first timestamp after rid started
-  for (i=0;i<trace_index;i++)
-    if (trace_table[i].timestamp_ns >= reserve_table[rid].current_job_activation_ticks &&
-	trace_table[i].timestamp_ns < now_ticks &&
-	trace_table[i].rid != rid &&
-	trace_table[i].event_type == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE){
-      if (trace_table[i+1].event_type == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_AFTER){
-	cumm_hyppreemption_ticks += (trace_table[i+1].timestamp_ns - trace_table[i].timestamp_ns);
-	i++;
-      }
-    }
+/*
+ * Time the current job of rid was preempted by hyptasks, as ingested so
+ * far from the hypervisor log (see ingest_hyp_debug_log()).
+ */
+unsigned long long calculate_hypertask_preemption_time_ticks(int rid){
+  struct reserve *rsv = &reserve_table[rid];
 
-  return cumm_hyppreemption_ticks;
+  if (rsv->hyp_preemption_job_ticks != rsv->current_job_activation_ticks){
+    // nothing ingested since the current job started
+    rsv->hyp_preemption_job_ticks = rsv->current_job_activation_ticks;
+    rsv->hyp_preemption_ticks = 0L;
+  }
+  return rsv->hyp_preemption_ticks;
 }
 
 /*********************************************************************/
@@ -1339,7 +2010,6 @@ unsigned long long calculate_hypertask_preemption_time_ticks(int rid, unsigned l
 void budget_enforcement(int rid, int request_stop)
 {
   struct task_struct *task;
-  int i;
   unsigned long long hypertask_preemption_time_ticks=0L;
 
   enforcement_start_timestamp_ticks = get_now_ticks();
@@ -1348,21 +2018,21 @@ void budget_enforcement(int rid, int request_stop)
   // If so, adjust the CPU consumption and reprogram the timer
 
   hypercall_start_timestamp_ticks = enforcement_start_timestamp_ticks;
-  if(!hypmtscheduler_dumpdebuglog(&debug_log, &debug_log_buffer_index)){
+  if(ingest_hyp_debug_log() < 0){
     printk(KERN_INFO "ZSRMV.budget_enforcement(): dumpdebuglog hypercall API failed\n");
   } else {
-    hypercall_end_timestamp_ticks = get_now_ticks();
-    cumm_hypercall_ticks += hypercall_end_timestamp_ticks - hypercall_start_timestamp_ticks;
-    if (wc_hypercall_ticks < (hypercall_end_timestamp_ticks - hypercall_start_timestamp_ticks)){
-      wc_hypercall_ticks = (hypercall_end_timestamp_ticks - hypercall_start_timestamp_ticks);
-    }
-    num_hypercalls ++;
-    for (i = 0; i< debug_log_buffer_index; i++){
-      add_trace_record(debug_log[i].hyptask_id, debug_log[i].timestamp, debug_log[i].event_type);
+    // reading the event ring is not a hypercall
+    if (hyp_event_ring_area == NULL){
+      hypercall_end_timestamp_ticks = get_now_ticks();
+      cumm_hypercall_ticks += hypercall_end_timestamp_ticks - hypercall_start_timestamp_ticks;
+      if (wc_hypercall_ticks < (hypercall_end_timestamp_ticks - hypercall_start_timestamp_ticks)){
+	wc_hypercall_ticks = (hypercall_end_timestamp_ticks - hypercall_start_timestamp_ticks);
+      }
+      num_hypercalls ++;
     }
 
-    // build a preemption intersection after we add the trace
-    hypertask_preemption_time_ticks = calculate_hypertask_preemption_time_ticks(rid, kernel_entry_timestamp_ticks);
+    // hyptask preemptions of the current job accumulated on ingestion
+    hypertask_preemption_time_ticks = calculate_hypertask_preemption_time_ticks(rid);
 
     if (reserve_table[rid].current_job_hypertasks_preemption_ticks < hypertask_preemption_time_ticks){
       reserve_table[rid].current_job_hypertasks_preemption_ticks = hypertask_preemption_time_ticks;
@@ -1386,7 +2056,7 @@ void budget_enforcement(int rid, int request_stop)
 
   // cancel the zero_slack timer just in case it is still active
   if (reserve_table[rid].has_zsenforcement){
-    hrtimer_cancel(&(reserve_table[rid].zero_slack_timer.kernel_timer));
+    del_zs_timerq(&(reserve_table[rid].zero_slack_timer));
   }
 
   reserve_table[rid].num_enforcements++;
@@ -1441,6 +2111,197 @@ void init_exectime_counters(int rid)
   reserve_table[rid].in_critical_mode=0;
 }
 
+/*
+ * Hyptask commands that do not have to complete before the scheduling
+ * decision (guestjobstart at a release, disablehyptask at completion,
+ * deletehyptask) are queued with zsrmlock held and issued in batches
+ * right after zsrmlock is released (see zsrm_unlock()), so the
+ * hypercalls do not lengthen the critical section. The queue is a
+ * single FIFO issued under hyp_cmd_issue_lock, which keeps the order
+ * of the commands of each reserve. Commands that must be synchronous
+ * (createhyptask) are issued under the same lock after the queued ones.
+ */
+#define HYP_CMD_QUEUE_SIZE 64
+#define HYP_CMD_BATCH_SIZE 16
+
+struct hyp_cmd_queue {
+  hypmtscheduler_batch_cmd_t cmds[HYP_CMD_QUEUE_SIZE];
+  int head;
+  int count;
+};
+
+struct hyp_cmd_queue hyp_cmdq;
+// protects hyp_cmdq
+DEFINE_RAW_SPINLOCK(hyp_cmdq_lock);
+// serializes the issue of the commands (and hyp_cmd_batch)
+DEFINE_RAW_SPINLOCK(hyp_cmd_issue_lock);
+hypmtscheduler_batch_cmd_t hyp_cmd_batch[HYP_CMD_BATCH_SIZE];
+
+// commands queued when the queue was full and issued in place
+unsigned long long num_hyp_cmd_overflows=0L;
+
+// issue n commands. Called with hyp_cmd_issue_lock held
+void hyp_cmd_issue(hypmtscheduler_batch_cmd_t *cmds, int n)
+{
+  int i;
+
+  if (!hypbackend->batch(cmds, n)){
+    for (i=0;i<n;i++){
+      if (!cmds[i].param.status){
+	printk("ZSRMV.hyp_cmd_issue(): command(%d) on hyptask handle(%u) FAILED\n",
+	       cmds[i].param.uhcall_fn, cmds[i].param.iparam_1);
+      }
+    }
+  }
+  num_hyp_batches++;
+  num_hyp_batched_cmds += n;
+}
+
+// move up to max queued commands to cmds. Returns the number moved
+int hyp_cmdq_pop(hypmtscheduler_batch_cmd_t *cmds, int max)
+{
+  unsigned long flags;
+  int n,i;
+
+  raw_spin_lock_irqsave(&hyp_cmdq_lock, flags);
+  n = (hyp_cmdq.count < max ? hyp_cmdq.count : max);
+  for (i=0;i<n;i++){
+    cmds[i] = hyp_cmdq.cmds[(hyp_cmdq.head + i) % HYP_CMD_QUEUE_SIZE];
+  }
+  hyp_cmdq.head = (hyp_cmdq.head + n) % HYP_CMD_QUEUE_SIZE;
+  hyp_cmdq.count -= n;
+  raw_spin_unlock_irqrestore(&hyp_cmdq_lock, flags);
+  return n;
+}
+
+// issue all the queued commands. Called with hyp_cmd_issue_lock held
+void hyp_cmdq_drain(void)
+{
+  int n;
+
+  while ((n = hyp_cmdq_pop(hyp_cmd_batch, HYP_CMD_BATCH_SIZE)) > 0){
+    hyp_cmd_issue(hyp_cmd_batch, n);
+  }
+}
+
+/*
+ * Issue the queued commands. Called after zsrmlock is released and by
+ * every holder of hyp_cmd_issue_lock after it releases it. If another
+ * CPU is issuing it also picks up the commands queued here: a command
+ * queued after that holder drained is issued by its own flush.
+ */
+void hyp_cmdq_flush(void)
+{
+  unsigned long flags;
+
+  while (READ_ONCE(hyp_cmdq.count) > 0){
+    if (!raw_spin_trylock_irqsave(&hyp_cmd_issue_lock, flags))
+      return;
+    hyp_cmdq_drain();
+    raw_spin_unlock_irqrestore(&hyp_cmd_issue_lock, flags);
+  }
+}
+
+// queue a command on the hyptask of rid. Called with zsrmlock held
+void hyp_cmdq_push(int rid, u8 uhcall_fn)
+{
+  hypmtscheduler_batch_cmd_t cmd;
+  unsigned long flags;
+
+  memset(&cmd, 0, sizeof(cmd));
+  cmd.param.uhcall_fn = uhcall_fn;
+  cmd.param.iparam_1 = reserve_table[rid].hyptask_handle;
+
+  raw_spin_lock_irqsave(&hyp_cmdq_lock, flags);
+  if (hyp_cmdq.count < HYP_CMD_QUEUE_SIZE){
+    hyp_cmdq.cmds[(hyp_cmdq.head + hyp_cmdq.count) % HYP_CMD_QUEUE_SIZE] = cmd;
+    hyp_cmdq.count++;
+    raw_spin_unlock_irqrestore(&hyp_cmdq_lock, flags);
+    return;
+  }
+  raw_spin_unlock_irqrestore(&hyp_cmdq_lock, flags);
+
+  // queue full: issue it now, after the queued ones
+  num_hyp_cmd_overflows++;
+  raw_spin_lock_irqsave(&hyp_cmd_issue_lock, flags);
+  hyp_cmdq_drain();
+  hyp_cmd_batch[0] = cmd;
+  hyp_cmd_issue(hyp_cmd_batch, 1);
+  raw_spin_unlock_irqrestore(&hyp_cmd_issue_lock, flags);
+  hyp_cmdq_flush();
+}
+
+/*
+ * Remove the last queued command on hyptask_handle if it is uhcall_fn
+ * (a later command on the same hyptask keeps it). Returns 1 if removed.
+ */
+int hyp_cmdq_cancel(u32 hyptask_handle, u8 uhcall_fn)
+{
+  unsigned long flags;
+  int i, idx, ret=0;
+
+  raw_spin_lock_irqsave(&hyp_cmdq_lock, flags);
+  for (i=hyp_cmdq.count-1; i>=0; i--){
+    idx = (hyp_cmdq.head + i) % HYP_CMD_QUEUE_SIZE;
+    if (hyp_cmdq.cmds[idx].param.iparam_1 != hyptask_handle)
+      continue;
+    if (hyp_cmdq.cmds[idx].param.uhcall_fn == uhcall_fn){
+      for (; i<hyp_cmdq.count-1; i++){
+	hyp_cmdq.cmds[(hyp_cmdq.head + i) % HYP_CMD_QUEUE_SIZE] =
+	  hyp_cmdq.cmds[(hyp_cmdq.head + i + 1) % HYP_CMD_QUEUE_SIZE];
+      }
+      hyp_cmdq.count--;
+      ret = 1;
+    }
+    break;
+  }
+  raw_spin_unlock_irqrestore(&hyp_cmdq_lock, flags);
+  return ret;
+}
+
+/*
+ * Job-path hyptask commands (guestjobstart at a release, disablehyptask
+ * at completion) go through a cache of what the hypervisor was told
+ * for the current job, and the ones with no effect are skipped:
+ *  - the same command again for the same job (e.g. a second completion);
+ *  - a disable after the hyptask already ran for the job (its
+ *    HYPTASKEXEC_BEFORE was ingested from the hypervisor log), as
+ *    there is nothing left to cancel until the next guestjobstart;
+ *  - a disable still queued when the next release queues guestjobstart:
+ *    the enforcement instant it was meant to cancel passed with the
+ *    period boundary, so it is dropped from the queue.
+ * Called with zsrmlock held.
+ */
+void hyp_job_cmd(int rid, u8 uhcall_fn)
+{
+  struct reserve *rsv = &reserve_table[rid];
+
+  if (rsv->hyp_cmd_last == uhcall_fn &&
+      rsv->hyp_cmd_last_job_ticks == rsv->current_job_activation_ticks){
+    rsv->hyp_cmds_saved++;
+    return;
+  }
+
+  rsv->hyp_cmd_last = uhcall_fn;
+  rsv->hyp_cmd_last_job_ticks = rsv->current_job_activation_ticks;
+
+  if (uhcall_fn == UAPP_HYPMTSCHEDULER_UHCALL_DISABLEHYPTASK &&
+      rsv->hyp_last_start_event == DEBUG_LOG_EVTTYPE_HYPTASKEXEC_BEFORE &&
+      rsv->hyp_last_start_ticks >= rsv->current_job_activation_ticks){
+    rsv->hyp_cmds_saved++;
+    return;
+  }
+
+  if (uhcall_fn == UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART &&
+      hyp_cmdq_cancel(rsv->hyptask_handle, UAPP_HYPMTSCHEDULER_UHCALL_DISABLEHYPTASK)){
+    rsv->hyp_cmds_saved++;
+    rsv->hyp_cmds_issued--;
+  }
+
+  hyp_cmdq_push(rid, uhcall_fn);
+  rsv->hyp_cmds_issued++;
+}
+
 /*********************************************************************/
 /*@requires fp11 && fp12 && fp13;
   @requires fp21 && fp22 && fp23;
@@ -1465,6 +2326,7 @@ void start_of_period(int rid)
   context_switch_start_timestamp_ticks = arrival_start_timestamp_ticks;
 
   reserve_table[rid].current_job_activation_ticks = kernel_entry_timestamp_ticks;
+  reserve_table[rid].current_job_release_ns = job_release_ns(rid, reserve_table[rid].job_activation_count);
   reserve_table[rid].current_job_hypertasks_preemption_ticks = 0L;
 
   if (reserve_table[rid].job_completed){
@@ -1473,9 +2335,8 @@ void start_of_period(int rid)
 
     // if the previous job completed successfuly then we should inform the hypervisor of
     // a new guest job really starting (as just continuing an old job)
-    if (!hypmtscheduler_guestjobstart(reserve_table[rid].hyptask_handle)) {
-	printk("ZSRMV.start_of_period(): hypmtscheduler_guestjobstart() FAILED\n");
-      }
+    if (reserve_table[rid].hypertask_active)
+      hyp_job_cmd(rid, UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART);
   }
   reserve_table[rid].job_completed = 0;
 
@@ -1506,7 +2367,7 @@ void start_of_period(int rid)
     printk("ZSRMMV.start_of_period(): ERROR %d consecutive calls to start of period from rid(%d)\n",reserve_table[rid].start_period,rid);
 
     // call budget_enforcement + cancel enforcement timer
-    hrtimer_cancel(&(reserve_table[rid].enforcement_timer.kernel_timer));
+    cancel_zs_timer(&(reserve_table[rid].enforcement_timer));
     budget_enforcement(rid, 0);
     //if (in_readyq(rid)){
     prev_calling_stop_from=calling_stop_from;
@@ -1524,10 +2385,10 @@ void start_of_period(int rid)
   printk("zsrm.start_of_period: start of period rid(%d)\n",rid);
 #endif
 
-  // cancel the zero_slack timer just in case it is still active
+  // re-arm the zero_slack timer (cancelling it in case it is still active)
+  // relative to the nominal release so it does not inherit the timer latency
   if (reserve_table[rid].has_zsenforcement){
-    hrtimer_cancel(&(reserve_table[rid].zero_slack_timer.kernel_timer));
-    add_timerq(&reserve_table[rid].zero_slack_timer);
+    add_zs_timerq(&reserve_table[rid].zero_slack_timer, reserve_table[rid].current_job_release_ns);
   }
 
   // increment the number of jobs activated
@@ -1632,6 +2493,8 @@ void zs_enforcement(int rid)
   printk("zsrmv.zs_enforcement rid(%d)\n",rid);
 
 #endif
+  add_trace_record(rid, ticks2ns(kernel_entry_timestamp_ticks), TRACE_EVENT_ZERO_SLACK);
+
   if (reserve_table[rid].enforced || reserve_table[rid].criticality < sys_criticality){
     zs_enforcement_start_timestamp_ticks = 0L;
 #ifdef __ZS_DEBUG__
@@ -1806,25 +2669,44 @@ int attach_reserve(int rid, int pid)
   printk("ZSRMMV: attached rid(%d) to pid(%d)\n",rid, pid);
 #endif
 
+  // record the first activation before arming the timers: every later
+  // release and zero-slack instant is an absolute offset from it
+  reserve_table[rid].first_job_activation_ns = ktime_to_ns(ktime_get());// ticks2ns(kernel_entry_timestamp_ticks);
+  reserve_table[rid].current_job_release_ns = reserve_table[rid].first_job_activation_ns;
+
+  // start hypertask hrtimer_restart
+  // (before the period timer: a hypervisor-driven reserve does not use it)
+#ifdef __ZSV_SECURE_TASK_BOOTSTRAP__
+	create_hypertask(rid);
+#else
+  // the hyptask was created before zsrmlock was taken (see zsrm_write())
+  if (reserve_table[rid].hypertask_active && hyp_release_doorbell != NULL &&
+      reserve_table[rid].hyptask_handle < HYPMTSCHEDULER_MAX_HYPTASKS){
+    // from now on releases are consumed from the doorbell
+    reserve_table[rid].hyp_driven_release = 1;
+  }
+#endif
+
   // TODO: should we move this to the activator??
-  add_timerq(&(reserve_table[rid].period_timer));
+  if (!reserve_table[rid].hyp_driven_release){
+    arm_absolute_timer(&(reserve_table[rid].period_timer), job_release_ns(rid, 1),
+		       reserve_table[rid].timer_slack_ns);
+  }
 
   if (reserve_table[rid].has_zsenforcement){
-    add_timerq(&(reserve_table[rid].zero_slack_timer));
+    add_zs_timerq(&(reserve_table[rid].zero_slack_timer), reserve_table[rid].current_job_release_ns);
   }
 
   add_trace_record(rid,ticks2ns(kernel_entry_timestamp_ticks),TRACE_EVENT_START_PERIOD);//ticks2ns(get_now_ticks()),TRACE_EVENT_START_PERIOD);
 
-  // start hypertask hrtimer_restart
-	create_hypertask(rid);
-
   // record the first activation
-  reserve_table[rid].first_job_activation_ns = ktime_to_ns(ktime_get());// ticks2ns(kernel_entry_timestamp_ticks);
   reserve_table[rid].job_activation_count++;
   reserve_table[rid].current_job_activation_ticks = kernel_entry_timestamp_ticks;
   reserve_table[rid].current_job_deadline_ticks = kernel_entry_timestamp_ticks +
     reserve_table[rid].hyp_enforcer_instant_ticks;
   reserve_table[rid].job_completed=1;
+  // the first guest job was started when the hyptask was created
+  reserve_table[rid].hyp_cmd_last_job_ticks = kernel_entry_timestamp_ticks;
 
   calling_start_from = 2;
   start_stac(rid);
@@ -1913,20 +2795,20 @@ int delete_reserve(int rid)
       printk("ZSRMMV: deleting reserve not in ready queue\n");
     }
   }
-  hrtimer_cancel(&(reserve_table[rid].enforcement_timer.kernel_timer));
-  hrtimer_cancel(&(reserve_table[rid].period_timer.kernel_timer));
+  cancel_zs_timer(&(reserve_table[rid].enforcement_timer));
+  cancel_zs_timer(&(reserve_table[rid].period_timer));
+  reserve_table[rid].hyp_driven_release = 0;
 
   if (reserve_table[rid].has_zsenforcement){
-    hrtimer_cancel(&(reserve_table[rid].zero_slack_timer.kernel_timer));
+    del_zs_timerq(&(reserve_table[rid].zero_slack_timer));
   }
 
   if (reserve_table[rid].hypertask_active){
 #ifndef __ZSV_SECURE_TASK_BOOTSTRAP__
-    if(!hypmtscheduler_deletehyptask(reserve_table[rid].hyptask_handle)){
-      printk("ZSRMV.delete_reserve(): error deleting hypertask\n");
-    } else {
-      reserve_table[rid].hypertask_active=0;
-    }
+    // issued when zsrmlock is released
+    hyp_cmdq_push(rid, UAPP_HYPMTSCHEDULER_UHCALL_DELETEHYPTASK);
+    reserve_table[rid].hypertask_active=0;
+    reserve_table[rid].hyp_cmd_last=0;
 #endif
   }
 
@@ -1984,6 +2866,8 @@ int start_enforcement_timer(struct reserve *rsvp)
 {
   unsigned long long rest_ticks;
   unsigned long long rest_ns;
+  unsigned long long now_ticks;
+  unsigned long long start_ns;
 
   //if (rsvp->current_exectime_ns < rsvp->exectime_ns){
   if (rsvp->exectime_ticks > (rsvp->current_exectime_ticks - rsvp->current_job_hypertasks_preemption_ticks)){
@@ -2006,7 +2890,15 @@ int start_enforcement_timer(struct reserve *rsvp)
 #ifdef __ZS_DEBUG__
   printk("ZSRMMV: start_enforcement_timer rid(%d) STARTED\n",rsvp->rid);
 #endif
-  add_timerq(&(rsvp->enforcement_timer));
+  // anchor the budget to the instant the reserve started running
+  // (start_ticks) instead of the instant this code runs
+  now_ticks = get_now_ticks();
+  start_ns = ktime_to_ns(ktime_get());
+  if (now_ticks > rsvp->start_ticks){
+    start_ns -= ticks2ns1(now_ticks - rsvp->start_ticks);
+  }
+  // no slack: a late enforcement would let the reserve overrun its budget
+  arm_absolute_timer(&(rsvp->enforcement_timer), start_ns + rest_ns, 0L);
   return 0;
 
   /* } else { */
@@ -2124,7 +3016,7 @@ void start(int rid)
     readyq->current_exectime_ticks += readyq->stop_ticks - readyq->start_ticks;
 
     // cancel timer
-    hrtimer_cancel(&(readyq->enforcement_timer.kernel_timer));
+    cancel_zs_timer(&(readyq->enforcement_timer));
 
     if (readyq->priority < reserve_table[rid].priority){
       new_runner = 1;
@@ -2281,7 +3173,7 @@ void stop(int rid)
     }
 
     // cancel timer
-    hrtimer_cancel(&(readyq->enforcement_timer.kernel_timer));
+    cancel_zs_timer(&(readyq->enforcement_timer));
 
     if (readyq == &reserve_table[rid]){
       readyq = readyq->next;
@@ -2357,14 +3249,12 @@ int wait_for_next_period(int rid, int nowait, int disableHypertask)
   add_trace_record(rid, ticks2ns(kernel_entry_timestamp_ticks), TRACE_EVENT_WFNP);//ticks2ns(departure_start_timestamp_ticks), TRACE_EVENT_WFNP);
 
   if (reserve_table[rid].hypertask_active && disableHypertask){
-    // cancel hyper_task
-    if(!hypmtscheduler_disablehyptask(reserve_table[rid].hyptask_handle)){
-      printk("ZSRMV.wait_next_period(): error calling the hypertask disable\n");
-    }
+    // cancel hyper_task (issued when zsrmlock is released)
+    hyp_job_cmd(rid, UAPP_HYPMTSCHEDULER_UHCALL_DISABLEHYPTASK);
   }
 
   if (reserve_table[rid].has_zsenforcement){
-    hrtimer_cancel(&(reserve_table[rid].zero_slack_timer.kernel_timer));
+    del_zs_timerq(&(reserve_table[rid].zero_slack_timer));
   }
 
   // Mark as periodic
@@ -2476,7 +3366,7 @@ int end_of_period(int rid)
   add_trace_record(rid, ticks2ns(kernel_entry_timestamp_ticks), TRACE_EVENT_END_PERIOD);//ticks2ns(departure_start_timestamp_ticks), TRACE_EVENT_END_PERIOD);
 
   if (reserve_table[rid].has_zsenforcement){
-    hrtimer_cancel(&(reserve_table[rid].zero_slack_timer.kernel_timer));
+    del_zs_timerq(&(reserve_table[rid].zero_slack_timer));
   }
 
   prev_calling_stop_from=calling_stop_from;
@@ -2656,9 +3546,19 @@ void init(void)
     @loop assigns i,reserve_table[0..(maxReserves-1)];*/
   for (i=0;i<MAX_RESERVES;i++) {
     reserve_table[i].first_job_activation_ns=0L;
+    reserve_table[i].current_job_release_ns=0L;
+    reserve_table[i].timer_slack_ns=0L;
     reserve_table[i].job_activation_count=0L;
     reserve_table[i].current_job_activation_ticks=0L;
     reserve_table[i].current_job_hypertasks_preemption_ticks=0L;
+    reserve_table[i].hyp_preemption_ticks=0L;
+    reserve_table[i].hyp_preemption_job_ticks=0L;
+    reserve_table[i].hyp_last_start_ticks=0L;
+    reserve_table[i].hyp_last_start_event=0;
+    reserve_table[i].hyp_cmd_last=0;
+    reserve_table[i].hyp_cmd_last_job_ticks=0L;
+    reserve_table[i].hyp_cmds_issued=0L;
+    reserve_table[i].hyp_cmds_saved=0L;
     reserve_table[i].enforcement_type = ENF_NONE;
     reserve_table[i].task_namespace=NULL;
     reserve_table[i].pid=-1;
@@ -2685,6 +3585,7 @@ void init(void)
     reserve_table[i].period_timer.rid = i;
     reserve_table[i].enforcement_timer.rid = i;
     reserve_table[i].zero_slack_timer.rid = i;
+    reserve_table[i].zero_slack_timer.timerq_index = -1;
     reserve_table[i].in_critical_mode=0;
     reserve_table[i].enforced=0;
     reserve_table[i].criticality=0;
@@ -2697,6 +3598,7 @@ void init(void)
     reserve_table[i].enforcement_signal_captured = 0;
     reserve_table[i].attached=0;
     reserve_table[i].hypertask_active = 0;
+    reserve_table[i].hyp_driven_release = 0;
 #ifdef STAC_FRAMAC_STUBS
     reserve_table[i].real_exectime_ns = 0;
     reserve_table[i].real_start_ns = 0;
@@ -2707,9 +3609,19 @@ void init(void)
 void init_reserve(int rid)
 {
   reserve_table[rid].first_job_activation_ns=0L;
+  reserve_table[rid].current_job_release_ns=0L;
+  reserve_table[rid].timer_slack_ns=0L;
   reserve_table[rid].job_activation_count=0L;
   reserve_table[rid].current_job_activation_ticks=0L;
   reserve_table[rid].current_job_hypertasks_preemption_ticks=0L;
+  reserve_table[rid].hyp_preemption_ticks=0L;
+  reserve_table[rid].hyp_preemption_job_ticks=0L;
+  reserve_table[rid].hyp_last_start_ticks=0L;
+  reserve_table[rid].hyp_last_start_event=0;
+  reserve_table[rid].hyp_cmd_last=0;
+  reserve_table[rid].hyp_cmd_last_job_ticks=0L;
+  reserve_table[rid].hyp_cmds_issued=0L;
+  reserve_table[rid].hyp_cmds_saved=0L;
   reserve_table[rid].task_namespace=NULL;
   reserve_table[rid].num_wfnp=0;
   reserve_table[rid].non_periodic_wait=0;
@@ -2732,6 +3644,7 @@ void init_reserve(int rid)
   reserve_table[rid].start_period=0;
   reserve_table[rid].hypertask_active=0;
   reserve_table[rid].has_hyptask=0;
+  reserve_table[rid].hyp_driven_release=0;
   reserve_table[rid].has_zsenforcement = 0;
 
   printk("ZSRMV: init_reserve(rid(%d))\n",rid);
@@ -2744,7 +3657,8 @@ void init_reserve(int rid)
 
   hrtimer_init(&(reserve_table[rid].period_timer.kernel_timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
   hrtimer_init(&(reserve_table[rid].enforcement_timer.kernel_timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
-  hrtimer_init(&(reserve_table[rid].zero_slack_timer.kernel_timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  // zero-slack instants are armed through the per-CPU zero-slack timer queue
+  reserve_table[rid].zero_slack_timer.timerq_index = -1;
 #ifdef __ZSV_SECURE_TASK_BOOTSTRAP__
   hrtimer_init(&(reserve_table[rid].start_timer.kernel_timer), CLOCK_MONOTONIC, HRTIMER_MODE_REL);
 #endif
@@ -2811,66 +3725,454 @@ struct task_struct *gettask(int pid,  struct pid_namespace *task_namespace){
 
 
 
-struct zs_timer *kernel_timer2zs_timer(struct hrtimer *tmr){
-  char *ztmrp = (char *) tmr;
-  ztmrp = ztmrp - (((char*) &(((struct zs_timer *)ztmrp)->kernel_timer))-ztmrp);
-  return (struct zs_timer *) ztmrp;
-}
+struct zs_timer *kernel_timer2zs_timer(struct hrtimer *tmr){
+  char *ztmrp = (char *) tmr;
+  ztmrp = ztmrp - (((char*) &(((struct zs_timer *)ztmrp)->kernel_timer))-ztmrp);
+  return (struct zs_timer *) ztmrp;
+}
+
+/*********************************************************************/
+//-- Deferred timer events
+//--
+//-- A timer that fires while zsrmlock is taken does not spin on the
+//-- lock. Its event is queued in the pending-event queue of the CPU
+//-- where it fired and processed by whoever releases zsrmlock next
+//-- (see zsrm_unlock()) or, if nobody holds the lock, from irq_work.
+/*********************************************************************/
+
+#define ZS_PENDING_EVENTS 256
+
+struct zs_pending_event {
+  struct zs_timer *timer;        // expired reserve timer, or
+  struct zs_timerq *timerq;      // expired zero-slack timer queue, or
+                                 // hypervisor doorbell if both are NULL
+  unsigned int timer_generation; // arm_generation of timer when it expired
+  unsigned long long enqueue_ticks;
+};
+
+struct zs_pending_queue {
+  raw_spinlock_t lock;
+  struct zs_pending_event events[ZS_PENDING_EVENTS];
+  int head;
+  int count;
+};
+
+struct zs_pending_queue zs_pending_table[NR_CPUS];
+
+// hypervisor release doorbell (NULL when releases are driven by hrtimers)
+hypmtscheduler_release_doorbell_t *hyp_release_doorbell = NULL;
+struct page *hyp_release_doorbell_page = NULL;
+atomic_t zs_num_pending_events = ATOMIC_INIT(0);
+struct irq_work zs_pending_work;
+
+/*
+ * Process the expiration of zstimer with zsrmlock held. The period
+ * timer is re-armed at the absolute release of the next job.
+ */
+void zs_timer_expired(struct zs_timer *zstimer)
+{
+  prevlocker = zstimer->timer_type;
+
+  if (timer_handler(zstimer) && !reserve_table[zstimer->rid].hyp_driven_release){
+    arm_absolute_timer(zstimer, job_release_ns(zstimer->rid, reserve_table[zstimer->rid].job_activation_count),
+		       reserve_table[zstimer->rid].timer_slack_ns);
+  }
+}
+
+/*
+ * Fire all the zero-slack instants of q that are due with zsrmlock held.
+ */
+void zs_timerq_expired(struct zs_timerq *q)
+{
+  struct zs_timer *zstimer;
+  unsigned long long now_ns;
+
+  // the hardware timer is no longer armed
+  q->programmed_ns = 0;
+  q->in_handler = 1;
+
+  now_ns = ktime_to_ns(ktime_get());
+  while (q->size > 0 && q->heap[0]->timerq_expiration_ns <= now_ns){
+    zstimer = q->heap[0];
+    del_zs_timerq(zstimer);
+    prevlocker = zstimer->timer_type;
+    timer_handler(zstimer);
+  }
+
+  q->in_handler = 0;
+  zs_timerq_program(q);
+}
+
+/*
+ * Move the release grid of reserve rid (first_job_activation_ns) so
+ * that the last of the pending periods published in the doorbell starts
+ * at its release_timestamp. The releases and zero-slack instants
+ * computed with job_release_ns() then follow the hypervisor instead of
+ * drifting from it. The timestamp is a counter value: it is converted
+ * to CLOCK_MONOTONIC through its age relative to now.
+ */
+void hyp_release_anchor(int rid, u32 count, u64 release_ticks)
+{
+  unsigned long long now_ticks, now_ns, age_ns, period_ns, last_job;
+
+  now_ticks = get_now_ticks();
+  now_ns = ktime_to_ns(ktime_get());
+  if (release_ticks == 0 || release_ticks > now_ticks)
+    return;
+
+  age_ns = ticks2ns1(now_ticks - release_ticks);
+  period_ns = reserve_table[rid].period.tv_sec * 1000000000L + reserve_table[rid].period.tv_nsec;
+  last_job = reserve_table[rid].job_activation_count + (u32)(count - reserve_table[rid].hyp_release_count) - 1;
+  if (age_ns > now_ns || now_ns - age_ns < period_ns * last_job)
+    return;
+
+  reserve_table[rid].first_job_activation_ns = now_ns - age_ns - period_ns * last_job;
+}
+
+/*
+ * Start the periods published in the hypervisor doorbell since the
+ * last time it was consumed, with zsrmlock held.
+ */
+void hyp_release_process(void)
+{
+  int rid;
+  u32 seq, count;
+  u64 release_ticks;
+  hypmtscheduler_release_doorbell_entry_t *entry;
+
+  for (rid=0; rid<MAX_RESERVES; rid++){
+    if (!reserve_table[rid].hyp_driven_release)
+      continue;
+
+    // seqcount read (see hypmtscheduler.h): retry while the hypervisor
+    // is writing the entry or wrote it while it was being read
+    entry = &hyp_release_doorbell->hyptask[reserve_table[rid].hyptask_handle];
+    do {
+      while ((seq = READ_ONCE(entry->release_seq)) & 1)
+	cpu_relax();
+      smp_rmb();
+      count = READ_ONCE(entry->release_count);
+      release_ticks = entry->release_timestamp;
+      smp_rmb();
+    } while (seq != READ_ONCE(entry->release_seq));
+
+    if (reserve_table[rid].hyp_release_count != count)
+      hyp_release_anchor(rid, count, release_ticks);
+
+    while (reserve_table[rid].hyp_release_count != count){
+      reserve_table[rid].hyp_release_count++;
+      num_hyp_releases++;
+      zs_timer_expired(&(reserve_table[rid].period_timer));
+    }
+  }
+}
+
+/*
+ * Queue a timer event that could not take zsrmlock. Called from the
+ * timer interrupt.
+ */
+void zs_defer_timer_event(struct zs_timer *zstimer, struct zs_timerq *q)
+{
+  struct zs_pending_queue *pq;
+  unsigned long flags;
+  int idx;
+
+  pq = &zs_pending_table[smp_processor_id()];
+
+  raw_spin_lock_irqsave(&pq->lock, flags);
+  atomic64_inc(&num_timer_contentions);
+  if (pq->count < ZS_PENDING_EVENTS){
+    idx = (pq->head + pq->count) % ZS_PENDING_EVENTS;
+    pq->events[idx].timer = zstimer;
+    pq->events[idx].timerq = q;
+    pq->events[idx].timer_generation = (zstimer != NULL ? READ_ONCE(zstimer->arm_generation) : 0);
+    pq->events[idx].enqueue_ticks = get_now_ticks();
+    pq->count++;
+    atomic64_inc(&num_timer_deferrals);
+    atomic_inc(&zs_num_pending_events);
+  } else {
+    atomic64_inc(&num_timer_drops);
+    printk("ZSRMMV.zs_defer_timer_event(type(%s)) pending-event queue full: event DROPPED\n",
+	   zstimer != NULL ? STRING_LOCKER(zstimer->timer_type) :
+	   q != NULL ? "timer_zs_queue" : "hyp_release");
+  }
+  raw_spin_unlock_irqrestore(&pq->lock, flags);
+
+  // process it as soon as the lock holder releases zsrmlock
+  irq_work_queue(&zs_pending_work);
+}
+
+/*
+ * Process the deferred timer events of all CPUs with zsrmlock held.
+ */
+void zs_process_pending_events(void)
+{
+  struct zs_pending_queue *pq;
+  struct zs_pending_event ev;
+  unsigned long flags;
+  unsigned long long latency_ticks;
+  int cpu;
+
+  if (atomic_read(&zs_num_pending_events) == 0)
+    return;
+
+  for_each_possible_cpu(cpu){
+    pq = &zs_pending_table[cpu];
+    while(1){
+      raw_spin_lock_irqsave(&pq->lock, flags);
+      if (pq->count == 0){
+	raw_spin_unlock_irqrestore(&pq->lock, flags);
+	break;
+      }
+      ev = pq->events[pq->head];
+      pq->head = (pq->head + 1) % ZS_PENDING_EVENTS;
+      pq->count--;
+      atomic_dec(&zs_num_pending_events);
+      raw_spin_unlock_irqrestore(&pq->lock, flags);
+
+      latency_ticks = get_now_ticks() - ev.enqueue_ticks;
+      cumm_deferral_ticks += latency_ticks;
+      num_processed_deferrals++;
+      if (wc_deferral_ticks < latency_ticks){
+	wc_deferral_ticks = latency_ticks;
+      }
+
+      if (ev.timerq != NULL){
+	zs_timerq_expired(ev.timerq);
+      } else if (ev.timer == NULL){
+	hyp_release_process();
+      } else if (ev.timer_generation == ev.timer->arm_generation &&
+		 !hrtimer_is_queued(&(ev.timer->kernel_timer))){
+	// a timer cancelled or re-armed since it was deferred (e.g. the
+	// enforcement timer at wait_for_next_period() or the timers of a
+	// deleted reserve) has a stale event that is discarded
+	zs_timer_expired(ev.timer);
+      }
+    }
+  }
+}
+
+/*
+ * Release zsrmlock. Deferred timer events are processed before the
+ * lock is released; events deferred after that are picked up by
+ * irq_work. The hyptask commands queued in the critical section are
+ * issued once the lock is released.
+ */
+void zsrm_unlock(unsigned long flags)
+{
+  zs_process_pending_events();
+
+  spin_unlock_irqrestore(&zsrmlock,flags);
+
+  hyp_cmdq_flush();
+
+  if (atomic_read(&zs_num_pending_events) > 0)
+    irq_work_queue(&zs_pending_work);
+}
+
+static void zs_pending_work_handler(struct irq_work *work)
+{
+  unsigned long flags;
+
+  if (!spin_trylock_irqsave(&zsrmlock,flags)){
+    // the holder processes the events when it releases the lock
+    atomic64_inc(&num_timer_contentions);
+    return;
+  }
+
+  prevlocker = PENDING_EVENTS;
+  zsrm_unlock(flags);
+}
+
+void init_pending_events(void)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu){
+    raw_spin_lock_init(&zs_pending_table[cpu].lock);
+    zs_pending_table[cpu].head = 0;
+    zs_pending_table[cpu].count = 0;
+  }
+  init_irq_work(&zs_pending_work, zs_pending_work_handler);
+}
+
+enum hrtimer_restart kernel_timer_handler(struct hrtimer *ktimer){
+  unsigned long flags;
+  struct zs_timer *zstimer;
+
+  zstimer = kernel_timer2zs_timer(ktimer);
+
+  if (!spin_trylock_irqsave(&zsrmlock,flags)){
+    zs_defer_timer_event(zstimer, NULL);
+    return HRTIMER_NORESTART;
+  }
+
+  zs_timer_expired(zstimer);
+
+  zsrm_unlock(flags);
+  return HRTIMER_NORESTART;
+}
+
+/*
+ * Hardware timer handler of a zero-slack timer queue: fires all the
+ * zero-slack instants that are due and reprograms the timer with the
+ * next one.
+ */
+enum hrtimer_restart zs_timerq_handler(struct hrtimer *ktimer){
+  unsigned long flags;
+  struct zs_timerq *q;
+
+  q = container_of(ktimer, struct zs_timerq, kernel_timer);
+
+  if (!spin_trylock_irqsave(&zsrmlock,flags)){
+    zs_defer_timer_event(NULL, q);
+    return HRTIMER_NORESTART;
+  }
+
+  zs_timerq_expired(q);
+
+  zsrm_unlock(flags);
+  return HRTIMER_NORESTART;
+}
+
+/*
+ * Virtual interrupt raised by the hypervisor after publishing hyptask
+ * period starts in the release doorbell.
+ */
+static irqreturn_t hyp_release_irq_handler(int irq, void *dev_id)
+{
+  unsigned long flags;
+
+  if (!spin_trylock_irqsave(&zsrmlock,flags)){
+    zs_defer_timer_event(NULL, NULL);
+    return IRQ_HANDLED;
+  }
+
+  prevlocker = TIMER_PERIOD;
+  hyp_release_process();
+
+  zsrm_unlock(flags);
+  return IRQ_HANDLED;
+}
+
+/*
+ * Register the release doorbell with the hypervisor. If anything fails
+ * the releases stay driven by the period hrtimers.
+ */
+void init_hyp_release(void)
+{
+  if (!hyp_driven_release)
+    return;
+
+  if (hyp_release_irq < 0){
+    printk("ZSRMV.init_hyp_release(): hyp_release_irq not set -- using period timers\n");
+    return;
+  }
+
+  hyp_release_doorbell_page = alloc_page(GFP_KERNEL | __GFP_ZERO);
+  if (hyp_release_doorbell_page == NULL){
+    printk("ZSRMV.init_hyp_release(): could not allocate doorbell page -- using period timers\n");
+    return;
+  }
+
+  if (request_irq(hyp_release_irq, hyp_release_irq_handler, 0, "zsrmv-release", NULL)){
+    printk("ZSRMV.init_hyp_release(): could not request irq %d -- using period timers\n",hyp_release_irq);
+    __free_page(hyp_release_doorbell_page);
+    hyp_release_doorbell_page = NULL;
+    return;
+  }
+
+  if (!hypbackend->registerreleasedoorbell(page_to_phys(hyp_release_doorbell_page), hyp_release_irq)){
+    printk("ZSRMV.init_hyp_release(): hypervisor rejected the release doorbell -- using period timers\n");
+    free_irq(hyp_release_irq, NULL);
+    __free_page(hyp_release_doorbell_page);
+    hyp_release_doorbell_page = NULL;
+    return;
+  }
+
+  hyp_release_doorbell = (hypmtscheduler_release_doorbell_t *) page_address(hyp_release_doorbell_page);
+  printk("ZSRMV.init_hyp_release(): releases driven by hypervisor doorbell on irq %d\n",hyp_release_irq);
+}
+
+void exit_hyp_release(void)
+{
+  if (hyp_release_doorbell == NULL)
+    return;
+
+  if (!hypbackend->registerreleasedoorbell(0, 0)){
+    printk("ZSRMV.exit_hyp_release(): error unregistering the release doorbell\n");
+  }
+  free_irq(hyp_release_irq, NULL);
+  hyp_release_doorbell = NULL;
+  __free_page(hyp_release_doorbell_page);
+  hyp_release_doorbell_page = NULL;
+}
+
+/*
+ * Register the event ring with the hypervisor. If it is rejected the
+ * hypervisor log keeps being read with the DUMPDEBUGLOG hypercall.
+ */
+void init_hyp_event_ring(void)
+{
+  hypmtscheduler_event_ring_t *ring;
+
+  if (!hyp_event_ring)
+    return;
+
+  hyp_event_ring_pages = alloc_pages(GFP_KERNEL | __GFP_ZERO, HYPMTSCHEDULER_EVENT_RING_ORDER);
+  if (hyp_event_ring_pages == NULL){
+    printk("ZSRMV.init_hyp_event_ring(): could not allocate event ring -- using dumpdebuglog\n");
+    return;
+  }
 
-enum hrtimer_restart kernel_timer_handler(struct hrtimer *ktimer){
-  unsigned long flags;
-  struct zs_timer *zstimer;
-  int tries;
-  int locked=0;
-  int restart_timer=0;
-  enum hrtimer_restart krestart = HRTIMER_NORESTART;
-  ktime_t kinterval;
-  ktime_t kabsexpiration;
-  unsigned long long abs_expiration_ns;
-
-  // *** DEBUGGING ONLY
-
-  tries = 1000000;
-  while(tries >0 && !(locked = spin_trylock_irqsave(&zsrmlock,flags)))
-    tries--;
-
-  if (!locked){
-    zstimer = kernel_timer2zs_timer(ktimer);
-    printk("ZSRMMV.kernel_timer_handler(type(%s)) spinlock locked by type(%s) cmd(%s): tied %d times. ABORT!\n",
-	   STRING_LOCKER(zstimer->timer_type),
-	   STRING_LOCKER(prevlocker),
-	   STRING_ZSV_CALL(zsrmcall),
-	   1000000);
-    return HRTIMER_NORESTART;
+  ring = (hypmtscheduler_event_ring_t *) page_address(hyp_event_ring_pages);
+  ring->size = HYPMTSCHEDULER_EVENT_RING_ENTRIES;
+
+  if (!hypbackend->registereventring(ring, sizeof(hypmtscheduler_event_ring_t))){
+    printk("ZSRMV.init_hyp_event_ring(): hypervisor rejected the event ring -- using dumpdebuglog\n");
+    __free_pages(hyp_event_ring_pages, HYPMTSCHEDULER_EVENT_RING_ORDER);
+    hyp_event_ring_pages = NULL;
+    return;
   }
 
-  //spin_lock_irqsave(&zsrmlock,flags);
+  hyp_event_ring_area = ring;
+  printk("ZSRMV.init_hyp_event_ring(): hypervisor log read from a %d-entry event ring\n",
+	 HYPMTSCHEDULER_EVENT_RING_ENTRIES);
+}
 
-  zstimer = kernel_timer2zs_timer(ktimer);
+void exit_hyp_event_ring(void)
+{
+  if (hyp_event_ring_area == NULL)
+    return;
 
-  prevlocker = zstimer->timer_type;
+  if (!hypbackend->registereventring(NULL, 0)){
+    printk("ZSRMV.exit_hyp_event_ring(): error unregistering the event ring\n");
+  }
+  hyp_event_ring_area = NULL;
+  __free_pages(hyp_event_ring_pages, HYPMTSCHEDULER_EVENT_RING_ORDER);
+  hyp_event_ring_pages = NULL;
+}
 
-  if (zstimer != NULL){
-    restart_timer = timer_handler(zstimer);
-    if (restart_timer){
-      zstimer->absolute_expiration_ns = zstimer->expiration.tv_sec * 1000000000L + zstimer->expiration.tv_nsec;
-      abs_expiration_ns = reserve_table[zstimer->rid].first_job_activation_ns +
-      	(zstimer->absolute_expiration_ns * reserve_table[zstimer->rid].job_activation_count);
-      kabsexpiration = ns_to_ktime(abs_expiration_ns);
-      hrtimer_start(ktimer, kabsexpiration, HRTIMER_MODE_ABS);
-      krestart = HRTIMER_NORESTART;
-      /* krestart = HRTIMER_RESTART; */
-      /* kinterval = ns_to_ktime(zstimer->absolute_expiration_ns); */
-      /* hrtimer_forward_now(ktimer, kinterval); */
-    } else {
-      krestart = HRTIMER_NORESTART;
-    }
-  } else {
-    printk("ZSRMV: kernel_timer_handler: zstimer == NULL\n");
+void init_zs_timerq(void)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu){
+    zs_timerq_table[cpu].size = 0;
+    zs_timerq_table[cpu].in_handler = 0;
+    zs_timerq_table[cpu].programmed_ns = 0;
+    hrtimer_init(&(zs_timerq_table[cpu].kernel_timer), CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    zs_timerq_table[cpu].kernel_timer.function = zs_timerq_handler;
   }
+}
 
-  spin_unlock_irqrestore(&zsrmlock,flags);
-  return krestart; //HRTIMER_NORESTART;
+void cancel_zs_timerq(void)
+{
+  int cpu;
+
+  for_each_possible_cpu(cpu){
+    hrtimer_cancel(&(zs_timerq_table[cpu].kernel_timer));
+  }
 }
 
 int reschedule_stack[MAX_RESERVES];
@@ -2990,7 +4292,7 @@ static void scheduler_task(void *a){
       zs_enforcement_end_timestamp_ticks = zs_enforcement_start_timestamp_ticks = 0L;
     }
 
-    spin_unlock_irqrestore(&zsrmlock,flags);
+    zsrm_unlock(flags);
 
     set_current_state(TASK_INTERRUPTIBLE);
     schedule();
@@ -3031,30 +4333,55 @@ int pop_to_activate(void){
 
 /**
  * Separate hypertask creating to be able to experiment
+ *
+ * Called without zsrmlock: zsrm_write() creates the hyptask of an
+ * ATTACH_RSV before taking it, so neither the hypercall nor the drain
+ * of the queued commands lengthens the critical section. The reserve
+ * is not attached yet, so no handler uses the fields written here.
+ * attach_reserve() then switches it to doorbell releases.
  */
 
 void create_hypertask(int rid)
 {
+  hypmtscheduler_batch_cmd_t cmds[2];
+  unsigned long flags;
+
   if (!reserve_table[rid].hypertask_active){
 #ifndef __ZSV_SECURE_TASK_BOOTSTRAP__
     if (reserve_table[rid].has_hyptask){
-      if(!hypmtscheduler_createhyptask(
-				       reserve_table[rid].hyp_enforcer_instant.tv_sec * HYPMTSCHEDULER_TIME_1SEC +
-				       (reserve_table[rid].hyp_enforcer_instant.tv_nsec / (1000 * 1000)) * HYPMTSCHEDULER_TIME_1MSEC,
-
-				       reserve_table[rid].period.tv_sec * HYPMTSCHEDULER_TIME_1SEC +
-				       (reserve_table[rid].period.tv_nsec / (1000 * 1000)) * HYPMTSCHEDULER_TIME_1MSEC,
-
-				       reserve_table[rid].priority, // priority
-				       rid, // 3, // hyptask_id?
-				       &(reserve_table[rid].hyptask_handle))){
+      // create the hyptask and start its first guest job in one
+      // hypercall, after the queued commands (e.g. the delete of a
+      // hyptask whose slot it may take)
+      memset(cmds, 0, sizeof(cmds));
+      cmds[0].param.uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_CREATEHYPTASK;
+      cmds[0].param.iparam_1 = ns2hyptime(reserve_table[rid].hyp_enforcer_instant_ns);
+      cmds[0].param.iparam_2 = ns2hyptime(reserve_table[rid].period_ns);
+      cmds[0].param.iparam_3 = reserve_table[rid].priority; // priority
+      cmds[0].param.iparam_4 = rid; // hyptask_id
+      cmds[1].param.uhcall_fn = UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART;
+      cmds[1].flags = HYPMTSCHEDULER_BATCH_PREV_HANDLE;
+
+      raw_spin_lock_irqsave(&hyp_cmd_issue_lock, flags);
+      hyp_cmdq_drain();
+      hypbackend->batch(cmds, 2);
+      raw_spin_unlock_irqrestore(&hyp_cmd_issue_lock, flags);
+      hyp_cmdq_flush();
+      if(!cmds[0].param.status){
 	printk(KERN_INFO "ZSRMV.activator_task(): hypmtschedulerkmod: create_hyptask failed\n");
       } else {
-	if (!hypmtscheduler_guestjobstart(reserve_table[rid].hyptask_handle)) {
+	reserve_table[rid].hyptask_handle = cmds[0].param.oparam_1;
+	if (!cmds[1].param.status) {
 	  printk("ZSRMV.activator_task(): hypmtscheduler_guestjobstart() FAILED\n");
 	} else {
 	  reserve_table[rid].hypertask_active=1;
+	  reserve_table[rid].hyp_cmd_last = UAPP_HYPMTSCHEDULER_UHCALL_GUESTJOBSTART;
 	  printk("ZSRMV.activator_task(): hyptscheduler_createhyptask() SUCCESSFUL\n");
+	  if (hyp_release_doorbell != NULL &&
+	      reserve_table[rid].hyptask_handle < HYPMTSCHEDULER_MAX_HYPTASKS){
+	    // releases after this one are consumed from the doorbell
+	    reserve_table[rid].hyp_release_count =
+	      READ_ONCE(hyp_release_doorbell->hyptask[reserve_table[rid].hyptask_handle].release_count);
+	  }
 	}
       }
     }
@@ -3116,17 +4443,74 @@ static void activator_task(void *a)
 
 /**
  *  TICKS TO NS FUNCTIONS
+ *
+ *  Conversions between counter ticks, ns and hypervisor time
+ *  (HYPMTSCHEDULER_TIME_1SEC per second) multiply by a fixed-point
+ *  factor, like the mult/shift of the kernel clocksources, so they need
+ *  no division. The factor keeps a 64-bit fraction (a shift of 64),
+ *  rounded up, which makes the truncated result exact for spans of
+ *  hours and within a tick beyond. The factors are calculated once from
+ *  the counter frequency.
  */
 
+struct zs_timebase {
+  u32 mult;	// integer part of to/from
+  u64 frac;	// fraction of to/from in units of 2^-64
+};
+
+// identity until calibrated
+struct zs_timebase tb_ticks2ns = {1, 0};
+struct zs_timebase tb_ns2ticks = {1, 0};
+struct zs_timebase tb_ns2hyp = {1, 0};
+
+void timebase_calc(struct zs_timebase *tb, u32 from, u32 to)
+{
+  u64 rem;
+  u32 r;
+
+  tb->mult = div_u64_rem(to, from, &r);
+  // long division of r * 2^64 by from, 32 bits at a time
+  tb->frac = div64_u64_rem(((u64)r) << 32, from, &rem) << 32;
+  tb->frac |= div64_u64_rem(rem << 32, from, &rem);
+  if (rem != 0)
+    tb->frac++;
+}
+
+// v * (mult + frac / 2^64) with 32x32-bit multiplications
+static inline unsigned long long timebase_convert(struct zs_timebase *tb, unsigned long long v)
+{
+  u32 vh = v >> 32, vl = (u32) v;
+  u32 fh = tb->frac >> 32, fl = (u32) tb->frac;
+  u64 hl = (u64) vh * fl;
+  u64 lh = (u64) vl * fh;
+  u64 mid;
+
+  mid = (((u64) vl * fl) >> 32) + (u32) hl + (u32) lh;
+  return v * tb->mult + (u64) vh * fh + (hl >> 32) + (lh >> 32) + (mid >> 32);
+}
+
+unsigned long long ns2hyptime(unsigned long long ns)
+{
+  return timebase_convert(&tb_ns2hyp, ns);
+}
+
+void init_timebase(void)
+{
+  timebase_calc(&tb_ns2hyp, NSEC_PER_SEC, HYPMTSCHEDULER_TIME_1SEC);
+}
+
 unsigned long long ticksperus=0L;
 
 
 void set_ticksperus(unsigned long long ticks, unsigned long long nanos){
 #ifdef __ZS_USE_SYSTSC__
-  ticksperus = rdcntfrq();
-  printk("ZSRMV: set_ticksperus(): rdcntfrq(%llu)\n",ticksperus);
-  ticksperus = DIV(ticksperus, 1000000UL);
-  printk("ZSRMV. ticksperus=%llu\n",ticksperus);
+  u32 freq;
+
+  freq = rdcntfrq();
+  timebase_calc(&tb_ticks2ns, freq, NSEC_PER_SEC);
+  timebase_calc(&tb_ns2ticks, NSEC_PER_SEC, freq);
+  printk("ZSRMV: set_ticksperus(): rdcntfrq(%u) ticks2ns(%u+0x%016llx) ns2ticks(%u+0x%016llx)\n",
+	 freq, tb_ticks2ns.mult, tb_ticks2ns.frac, tb_ns2ticks.mult, tb_ns2ticks.frac);
 #else
 
   ticksperus = ticks *1000;
@@ -3155,14 +4539,7 @@ unsigned long long ticks2ns1(unsigned long long ticks)
 
 /* #ifdef __ZS_USE_TSC__   */
 #ifdef __ZS_USE_SYSTSC__
-  unsigned long long ns;
-
-  ns = ticks*1000;
-  //ns = ticks*10;
-  ns = DIV(ns,ticksperus);
-  //ns = ns / ticksperus;
-
-  return ns;
+  return timebase_convert(&tb_ticks2ns, ticks);
 #else
   return ticks;
 #endif
@@ -3180,15 +4557,7 @@ unsigned long long ns2ticks(unsigned long long ns)
 
   //#ifdef __ZS_USE_TSC__
 #ifdef __ZS_USE_SYSTSC__
-
-  unsigned long long ticks;
-
-  ticks = ns * ticksperus;
-  ticks = DIV(ticks,1000);
-  //ticks = DIV(ticks,10);
-  //ticks = ticks / 1000;
-
-  return ticks;
+  return timebase_convert(&tb_ns2ticks, ns);
 #else
   return ns;
 #endif
@@ -3326,7 +4695,7 @@ int test_reserve(int option)
 
     switch (option){
     case 0:
-    	if(!hypmtscheduler_createhyptask(1 * HYPMTSCHEDULER_TIME_1SEC, // first time
+    	if(!hypbackend->createhyptask(1 * HYPMTSCHEDULER_TIME_1SEC, // first time
 				       //+X * HYPMTSCHEDULER_TIME_1USEC,
 				       2 * HYPMTSCHEDULER_TIME_1SEC, // sticky period
 				       //+ (reserve_table[rid].period.tv_nsec / 1000) * HYPMTSCHEDULER_TIME_1USEC,
@@ -3338,7 +4707,7 @@ int test_reserve(int option)
 	printk(KERN_INFO "ZSRMV.test_reserve(): hyptask1 created\n");
       }
 
-    	if(!hypmtscheduler_createhyptask(//1 * HYPMTSCHEDULER_TIME_1SEC, // first time
+    	if(!hypbackend->createhyptask(//1 * HYPMTSCHEDULER_TIME_1SEC, // first time
 				       //500000 * HYPMTSCHEDULER_TIME_1USEC,
     		  	  	  (0.5 * HYPMTSCHEDULER_TIME_1SEC),
 				       1 * HYPMTSCHEDULER_TIME_1SEC, // sticky period
@@ -3353,7 +4722,7 @@ int test_reserve(int option)
 
       break;
     case 1:
-    	if(!hypmtscheduler_deletehyptask(hyptask_handle1)){
+    	if(!hypbackend->deletehyptask(hyptask_handle1)){
 	  printk("ZSRMV.test_reserve(): error deleting hypertask1\n");
 	} else {
 	  printk("ZSRMV.test_reserve(): hypertask1 deleted\n");
@@ -3361,7 +4730,7 @@ int test_reserve(int option)
 
 #if 1
 
-	if(!hypmtscheduler_deletehyptask(hyptask_handle2)){
+	if(!hypbackend->deletehyptask(hyptask_handle2)){
 	  printk("ZSRMV.test_reserve(): error deleting hypertask2\n");
 	} else {
 	  printk("ZSRMV.test_reserve(): hypertask2 deleted\n");
@@ -3378,90 +4747,181 @@ int test_reserve(int option)
 }
 
 
-#define SERIAL_RECEIVING_BUFFER_SIZE 2048
+#define DEFAULT_SERIAL_RX_RING_SIZE 2048
+#define DEFAULT_SERIAL_TX_RING_SIZE 1024
+
+// bytes of the serial rings (rounded up to a power of two)
+static int serial_rx_ring_size=DEFAULT_SERIAL_RX_RING_SIZE;
+module_param(serial_rx_ring_size, int, 0440);
+static int serial_tx_ring_size=DEFAULT_SERIAL_TX_RING_SIZE;
+module_param(serial_tx_ring_size, int, 0440);
+
+// register the tx ring with the uberapp and send spans of it in place
+// (falls back to copying 8-byte sends if the uberapp rejects it)
+static int serial_tx_zero_copy=1;
+module_param(serial_tx_zero_copy, int, 0440);
 
-struct semaphore serial_buffer_sem;
+/*
+ * Single-producer/single-consumer byte ring. head is only written by
+ * the producer and tail by the consumer, both free-running and indexing
+ * data modulo size. The producer copies the bytes before publishing
+ * head (release) and the consumer reads them before publishing tail,
+ * so neither side takes a lock. Bytes that do not fit are dropped.
+ * data is physically contiguous so that it can be handed to the
+ * hypervisor (see init_serial_tx_buffer()).
+ */
+struct serial_ring {
+  u8 *data;
+  u32 size;
+  u32 mask;
+  u32 head;
+  u32 tail;
+  u32 high_watermark;
+  unsigned long long dropped;
+};
+
+// rx: serial receiver task -> receive()
+struct serial_ring serial_rx_ring;
+// tx: send() (with zsrmlock held) -> serial sending task
+struct serial_ring serial_tx_ring;
+
+int serial_ring_alloc(struct serial_ring *ring, int size)
+{
+  memset(ring, 0, sizeof(struct serial_ring));
+  ring->size = roundup_pow_of_two(size);
+  ring->mask = ring->size - 1;
+  ring->data = (u8 *) __get_free_pages(GFP_KERNEL | __GFP_ZERO, get_order(ring->size));
+  if (ring->data == NULL)
+    return -ENOMEM;
+  return 0;
+}
 
-u8 serial_receiving_buffer[SERIAL_RECEIVING_BUFFER_SIZE];
+void serial_ring_free(struct serial_ring *ring)
+{
+  if (ring->data != NULL){
+    free_pages((unsigned long) ring->data, get_order(ring->size));
+    ring->data = NULL;
+  }
+}
 
-#define SERIAL_RECEIVING_CIRCULAR_INC(a) ( (a==SERIAL_RECEIVING_BUFFER_SIZE-1) ? 0 : a+1)
+static inline u32 serial_ring_count(struct serial_ring *ring)
+{
+  return READ_ONCE(ring->head) - READ_ONCE(ring->tail);
+}
 
-static DECLARE_WAIT_QUEUE_HEAD(serial_read_wait_queue);
+// producer side: returns the number of bytes copied
+u32 serial_ring_put(struct serial_ring *ring, u8 *buffer, u32 len)
+{
+  u32 head = ring->head;
+  u32 used = head - smp_load_acquire(&ring->tail);
+  u32 n = min(len, ring->size - used);
+  u32 off = head & ring->mask;
+  u32 span = min(n, ring->size - off);
+
+  memcpy(ring->data + off, buffer, span);
+  memcpy(ring->data, buffer + span, n - span);
+  smp_store_release(&ring->head, head + n);
+
+  if (ring->high_watermark < used + n)
+    ring->high_watermark = used + n;
+  if (n < len)
+    ring->dropped += len - n;
+
+  return n;
+}
 
-// point to next byte to read
-volatile int serial_receiving_reading_index=0;
+// consumer side: contiguous bytes readable in place at offset *off
+static inline u32 serial_ring_peek(struct serial_ring *ring, u32 *off)
+{
+  u32 tail = ring->tail;
 
-// point to next byte to write
-volatile int serial_receiving_writing_index=0;
-volatile int waiting_for_input=0;
+  *off = tail & ring->mask;
+  return min(smp_load_acquire(&ring->head) - tail, ring->size - *off);
+}
 
-int serial_data_dropped=0;
+// consumer side: release n bytes read in place
+static inline void serial_ring_consume(struct serial_ring *ring, u32 n)
+{
+  smp_store_release(&ring->tail, ring->tail + n);
+}
 
-int serial_receiving_buffer_write(u8 *buffer, int len)
+// consumer side: returns the number of bytes copied
+u32 serial_ring_get(struct serial_ring *ring, u8 *buffer, u32 len)
 {
-  static int reported_full=0;
-  static int invocation_cnt=0;
-  int wrote=0;
-  int i=0;
-  int wasempty=0;
+  u32 tail = ring->tail;
+  u32 n = min(len, smp_load_acquire(&ring->head) - tail);
+  u32 off = tail & ring->mask;
+  u32 span = min(n, ring->size - off);
 
-  invocation_cnt++;
-  down_interruptible(&serial_buffer_sem);
+  memcpy(buffer, ring->data + off, span);
+  memcpy(buffer + span, ring->data, n - span);
+  smp_store_release(&ring->tail, tail + n);
 
-  wasempty = (serial_receiving_writing_index == serial_receiving_reading_index);
+  return n;
+}
 
-  while(SERIAL_RECEIVING_CIRCULAR_INC(serial_receiving_writing_index) != serial_receiving_reading_index && i<len){
-    serial_receiving_buffer[serial_receiving_writing_index] = buffer[i];
-    serial_receiving_writing_index = SERIAL_RECEIVING_CIRCULAR_INC(serial_receiving_writing_index);
-    i++;
-    wrote++;
+int init_serial_rings(void)
+{
+  if (serial_rx_ring_size <= 0)
+    serial_rx_ring_size = DEFAULT_SERIAL_RX_RING_SIZE;
+  if (serial_tx_ring_size <= 0)
+    serial_tx_ring_size = DEFAULT_SERIAL_TX_RING_SIZE;
+
+  if (serial_ring_alloc(&serial_rx_ring, serial_rx_ring_size) < 0 ||
+      serial_ring_alloc(&serial_tx_ring, serial_tx_ring_size) < 0){
+    printk("ZSRMV.init_serial_rings(): could not allocate the serial rings\n");
+    return -ENOMEM;
   }
+  return 0;
+}
+
+void free_serial_rings(void)
+{
+  serial_ring_free(&serial_rx_ring);
+  serial_ring_free(&serial_tx_ring);
+}
+
+static DECLARE_WAIT_QUEUE_HEAD(serial_read_wait_queue);
+
+// readers of the rx ring take turns (the receiver task never takes it)
+static DEFINE_MUTEX(serial_rx_read_mutex);
+
+int serial_receiving_buffer_write(u8 *buffer, int len)
+{
+  static int reported_full=0;
+  int wrote;
+
+  wrote = serial_ring_put(&serial_rx_ring, buffer, len);
 
   // Were there bytes I could not write?
-  if (SERIAL_RECEIVING_CIRCULAR_INC(serial_receiving_writing_index) == serial_receiving_reading_index && i<len){
-    serial_data_dropped=1;
-    if (!reported_full){
-      printk("ZSRM.serial_receiving_buffer_write(): invocation(%d) len(%d) buffer full dropped %d bytes\n",invocation_cnt, len, (len-i));
-      reported_full=1;
-    }
+  if (wrote < len && !reported_full){
+    printk("ZSRM.serial_receiving_buffer_write(): len(%d) buffer full dropped %d bytes\n", len, (len-wrote));
+    reported_full=1;
   }
 
   // Try always sending the wakeup
-  //if (wasempty){
   wake_up_interruptible(&serial_read_wait_queue);
-  //printk("ZSRM.serial_receiving_buffer_write(): wasempty SENT wakeup\n");
-  //}
-
-  up(&serial_buffer_sem);
 
   return wrote;
 }
 
 int serial_receiving_buffer_read(u8 *buffer, int len)
 {
-  int i=0;
-  int read=0;
+  int read;
 
-  down_interruptible(&serial_buffer_sem);
+  if (mutex_lock_interruptible(&serial_rx_read_mutex))
+    return 0;
 
-  if (serial_receiving_writing_index == serial_receiving_reading_index){
-    up(&serial_buffer_sem);
-    //printk("ZSRM.serial_receiving_buffer_read(): EMPTY going to sleep\n");
+  if (serial_ring_count(&serial_rx_ring) == 0){
     SERIAL_DEBUG_FLAG_ON(SERIAL_FLAG_RCV_READ_BLOCKED);
     wait_event_interruptible(serial_read_wait_queue,
-    			     (serial_receiving_writing_index != serial_receiving_reading_index ));
+    			     (serial_ring_count(&serial_rx_ring) != 0));
     SERIAL_DEBUG_FLAG_OFF(SERIAL_FLAG_RCV_READ_BLOCKED);
-    down_interruptible(&serial_buffer_sem);
   }
 
-  while(serial_receiving_writing_index != serial_receiving_reading_index && i<len){
-    buffer[i] = serial_receiving_buffer[serial_receiving_reading_index];
-    serial_receiving_reading_index = SERIAL_RECEIVING_CIRCULAR_INC(serial_receiving_reading_index);
-    i++;
-    read++;
-  }
+  read = serial_ring_get(&serial_rx_ring, buffer, len);
 
-  up(&serial_buffer_sem);
+  mutex_unlock(&serial_rx_read_mutex);
 
   return read;
 }
@@ -3501,21 +4961,37 @@ static void serial_receiver_task(void *a)
   struct task_struct *task;
   u8 buffer[100];
   u32 len_read;
+  u32 total_read;
   bool readbufferexhausted=false;
   int wasempty=0;
+  unsigned long long latency_ticks;
+  ktime_t timeout;
 
   printk("ZSRMV.serial_receiver_task() READY!\n");
 
+  serial_rx_poll_us = serial_rx_poll_min_us;
+
   while (!kthread_should_stop()) {
     len_read=0;
+    total_read=0;
+    num_serial_rx_wakeups++;
+    if (atomic_xchg(&serial_rx_irq_pending, 0)){
+      latency_ticks = get_now_ticks() - READ_ONCE(serial_rx_irq_timestamp_ticks);
+      num_serial_rx_irq_wakeups++;
+      cumm_serial_rx_latency_ticks += latency_ticks;
+      if (wc_serial_rx_latency_ticks < latency_ticks){
+	wc_serial_rx_latency_ticks = latency_ticks;
+      }
+    }
 #ifdef __SERIAL_HARDWARE_CONTROL_FLOW__
     serial_stop_transmission();
     SERIAL_DEBUG_FLAG_ON(SERIAL_FLAG_HWR_SND_BLOCKED);
 #endif
     do {
       readbufferexhausted=false;
-      if(mavlinkserhb_recv(&buffer, sizeof(buffer), &len_read, &readbufferexhausted)){
+      if(hypbackend->serial_recv(&buffer, sizeof(buffer), &len_read, &readbufferexhausted)){
 	if (len_read >0){
+	  total_read += len_read;
 	  serial_receiving_buffer_write(buffer,len_read);
 	} else {
 	  //readbufferexhausted=true;
@@ -3542,12 +5018,26 @@ static void serial_receiver_task(void *a)
 #endif
     serial_debug_before_sleep_timestamp_ticks = get_now_ticks();
 
-    if (!kthread_should_stop()){
-      usleep_range(290,300);
+    // NAPI-style: poll fast while data keeps coming, back off when idle
+    if (total_read > 0){
+      serial_rx_poll_us = serial_rx_poll_min_us;
+    } else {
+      num_serial_rx_empty_wakeups++;
+      serial_rx_poll_us = min(serial_rx_poll_us * 2, serial_rx_poll_max_us);
     }
 
-    /* set_current_state(TASK_INTERRUPTIBLE); */
-    /* schedule(); */
+    if (serial_rx_irq_active){
+      // sleep until the rx interrupt (the pending flag closes the race
+      // with an interrupt raised while we were reading)
+      set_current_state(TASK_INTERRUPTIBLE);
+      if (!atomic_read(&serial_rx_irq_pending) && !kthread_should_stop()){
+	timeout = ns_to_ktime(serial_rx_poll_max_us * 1000LL);
+	schedule_hrtimeout_range(&timeout, serial_rx_poll_max_us * 125LL, HRTIMER_MODE_REL);
+      }
+      __set_current_state(TASK_RUNNING);
+    } else if (!kthread_should_stop()){
+      usleep_range(serial_rx_poll_us, serial_rx_poll_us + serial_rx_poll_us/8);
+    }
 
 
     serial_debug_after_sleep_timestamp_ticks = get_now_ticks();
@@ -3561,80 +5051,160 @@ static void serial_receiver_task(void *a)
 }
 
 
-#define SERIAL_SENDING_BUFFER_SIZE 1024
-
-struct semaphore serial_sending_buffer_sem;
+/*
+ * Virtual interrupt raised by the mavlinkserhb uberapp when bytes
+ * arrive to an empty UART receive buffer.
+ */
+static irqreturn_t serial_rx_irq_handler(int irq, void *dev_id)
+{
+  num_serial_rx_irqs++;
+  if (!atomic_read(&serial_rx_irq_pending)){
+    WRITE_ONCE(serial_rx_irq_timestamp_ticks, get_now_ticks());
+    atomic_set(&serial_rx_irq_pending, 1);
+  }
+  wake_up_process(serial_recv_task);
+  return IRQ_HANDLED;
+}
 
-u8 serial_sending_buffer[SERIAL_SENDING_BUFFER_SIZE];
+/*
+ * Register the rx interrupt with the uberapp. If anything fails the
+ * serial receiver keeps polling.
+ */
+void init_serial_rx_irq(void)
+{
+  if (serial_rx_poll_min_us < 10)
+    serial_rx_poll_min_us = 10;
+  if (serial_rx_poll_max_us < serial_rx_poll_min_us)
+    serial_rx_poll_max_us = serial_rx_poll_min_us;
+
+  if (serial_rx_irq < 0){
+    printk("ZSRMV.init_serial_rx_irq(): serial_rx_irq not set -- polling every %d-%d us\n",
+	   serial_rx_poll_min_us, serial_rx_poll_max_us);
+    return;
+  }
 
-#define SERIAL_SENDING_CIRCULAR_INC(a) ( (a == SERIAL_SENDING_BUFFER_SIZE-1) ? 0 : a+1)
+  if (request_irq(serial_rx_irq, serial_rx_irq_handler, 0, "zsrmv-serial-rx", NULL)){
+    printk("ZSRMV.init_serial_rx_irq(): could not request irq %d -- polling\n",serial_rx_irq);
+    return;
+  }
 
-static DECLARE_WAIT_QUEUE_HEAD(serial_write_wait_queue);
+  if (!hypbackend->serial_registerrxirq(serial_rx_irq)){
+    printk("ZSRMV.init_serial_rx_irq(): uberapp rejected the rx irq -- polling\n");
+    free_irq(serial_rx_irq, NULL);
+    return;
+  }
 
-// point ot next byte to read
-volatile int serial_sending_reading_index=0;
+  serial_rx_irq_active = 1;
+  printk("ZSRMV.init_serial_rx_irq(): serial receiver woken by irq %d\n",serial_rx_irq);
+}
 
-// point to next byte to write
-volatile int serial_sending_writing_index=0;
+void exit_serial_rx_irq(void)
+{
+  if (!serial_rx_irq_active)
+    return;
 
-int serial_sending_buffer_write(u8 *buffer, int len){
-  int was_empty=0;
-  int i=0;
-  int wrote=0;
+  if (!hypbackend->serial_registerrxirq(0)){
+    printk("ZSRMV.exit_serial_rx_irq(): error unregistering the rx irq\n");
+  }
+  free_irq(serial_rx_irq, NULL);
+  serial_rx_irq_active = 0;
+}
 
-  down_interruptible(&serial_sending_buffer_sem);
+static DECLARE_WAIT_QUEUE_HEAD(serial_write_wait_queue);
 
-  was_empty = (serial_sending_writing_index == serial_sending_reading_index);
+int serial_sending_buffer_write(u8 *buffer, int len){
+  int wrote;
 
-  while(SERIAL_SENDING_CIRCULAR_INC(serial_sending_writing_index) != serial_sending_reading_index && i < len){
-    serial_sending_buffer[serial_sending_writing_index] = buffer[i];
-    serial_sending_writing_index = SERIAL_SENDING_CIRCULAR_INC(serial_sending_writing_index);
-    i++;
-    wrote++;
-  }
+  wrote = serial_ring_put(&serial_tx_ring, buffer, len);
 
-  if (SERIAL_SENDING_CIRCULAR_INC(serial_sending_writing_index) == serial_sending_reading_index && i<len){
+  if (wrote < len){
     printk("ZSRM.serial_sending_buffer_write(): dropped data\n");
   }
 
-  //if (was_empty){
-    // wakeup transmiter kernel task
+  // wakeup transmiter kernel task
   wake_up_process(serial_sender_task);
-  //wake_up_interruptible(&serial_write_wait_queue);
-   //}
-
-  up(&serial_sending_buffer_sem);
 
   return wrote;
 }
 
 int serial_sending_buffer_read(u8 *buffer, int len){
-  int i=0;
-  int read=0;
+  // if sending task receives zero it should go to sleep
+  return serial_ring_get(&serial_tx_ring, buffer, len);
+}
 
-  down_interruptible(&serial_sending_buffer_sem);
+// wait when the UART does not accept bytes (~100 bytes at 921600 bauds)
+#define SERIAL_TX_STALL_US 100
+// consecutive failed spans before falling back to copying sends
+#define SERIAL_TX_MAX_ERRORS 16
 
-  if (serial_sending_writing_index == serial_sending_reading_index){
-    up(&serial_sending_buffer_sem);
-    /* wait_event_interruptible(serial_write_wait_queue,  */
-    /* 			     (serial_sending_writing_index != serial_sending_reading_index )); */
+int serial_tx_zero_copy_active=0;
+int serial_tx_consecutive_errors=0;
+unsigned long long num_serial_tx_spans=0L;
+unsigned long long num_serial_tx_bytes=0L;
+unsigned long long num_serial_tx_stalls=0L;
+unsigned long long num_serial_tx_errors=0L;
 
-    /* down_interruptible(&serial_sending_buffer_sem); */
-    // if sending task receives zero it should go to sleep
-    return 0;
+/*
+ * Register the tx ring with the uberapp so that the sending task hands
+ * it spans of the ring instead of copying them. If it is rejected the
+ * bytes are copied into the hypercall buffer page.
+ */
+void init_serial_tx_buffer(void)
+{
+  if (!serial_tx_zero_copy)
+    return;
+
+  if (!hypbackend->serial_registertxbuffer(serial_tx_ring.data, serial_tx_ring.size)){
+    printk("ZSRMV.init_serial_tx_buffer(): uberapp rejected the tx buffer -- copying sends\n");
+    return;
   }
 
-  while(serial_sending_writing_index != serial_sending_reading_index && i<len){
-    buffer[i] = serial_sending_buffer[serial_sending_reading_index];
-    serial_sending_reading_index = SERIAL_SENDING_CIRCULAR_INC(serial_sending_reading_index);
-    i++;
-    read++;
+  serial_tx_zero_copy_active = 1;
+  printk("ZSRMV.init_serial_tx_buffer(): sending in place from a %u-byte tx ring\n",serial_tx_ring.size);
+}
+
+void exit_serial_tx_buffer(void)
+{
+  if (!serial_tx_zero_copy_active)
+    return;
+
+  if (!hypbackend->serial_registertxbuffer(NULL, 0)){
+    printk("ZSRMV.exit_serial_tx_buffer(): error unregistering the tx buffer\n");
   }
+  serial_tx_zero_copy_active = 0;
+}
+
+/*
+ * Send the contiguous bytes at the tail of the tx ring in place.
+ * Returns the number of bytes the UART accepted.
+ */
+u32 serial_send_span(void)
+{
+  u32 off, span, sent=0;
 
-  up(&serial_sending_buffer_sem);
+  span = serial_ring_peek(&serial_tx_ring, &off);
+  if (span == 0)
+    return 0;
 
-  return read;
+  if (!hypbackend->serial_sendspan(off, span, &sent)){
+    printk_ratelimited("ZSRM.serial_send_span(): ERROR sending %u bytes at %u\n",span,off);
+    num_serial_tx_errors++;
+    if (++serial_tx_consecutive_errors >= SERIAL_TX_MAX_ERRORS){
+      printk("ZSRM.serial_send_span(): %d failed spans -- copying sends\n",serial_tx_consecutive_errors);
+      exit_serial_tx_buffer();
+    }
+    return 0;
+  }
+  serial_tx_consecutive_errors = 0;
 
+  if (sent > 0){
+    serial_ring_consume(&serial_tx_ring, sent);
+    num_serial_tx_spans++;
+    num_serial_tx_bytes += sent;
+  } else {
+    num_serial_tx_stalls++;
+  }
+  return sent;
 }
 
 static int sending_task_active=1;
@@ -3649,20 +5219,32 @@ static void serial_sending_task(void *a){
   while(!kthread_should_stop()){
     while(sending_task_active && !kthread_should_stop()){
       sending_index=0;
-      if ((read = serial_sending_buffer_read(buffer, 100)) > 0){
+      if (serial_tx_zero_copy_active && serial_ring_count(&serial_tx_ring) > 0){
+	while(serial_is_reception_stopped() && !kthread_should_stop()){
+	  usleep_range(590,600);
+	}
+	if (serial_send_span() == 0){
+	  usleep_range(SERIAL_TX_STALL_US, SERIAL_TX_STALL_US+10);
+	}
+      } else if (!serial_tx_zero_copy_active && (read = serial_sending_buffer_read(buffer, 100)) > 0){
 	while(sending_index < read && !kthread_should_stop()){
 	  batch_size = (read-sending_index > 8 ) ? 8 : (read-sending_index);
 	  while(serial_is_reception_stopped() && !kthread_should_stop()){
 	    usleep_range(590,600);
 	  }
-	  ret = mavlinkserhb_send(&buffer[sending_index],batch_size);
+	  ret = hypbackend->serial_send(&buffer[sending_index],batch_size);
 	  sending_index += batch_size;
+	  num_serial_tx_spans++;
+	  num_serial_tx_bytes += batch_size;
 	}
       } else {
-	// go to sleep
+	// go to sleep (re-checking after setting the state so that a
+	// wakeup from serial_sending_buffer_write() is not lost)
 	SERIAL_DEBUG_FLAG_ON(SERIAL_FLAG_SND_READ_BLOCKED);
 	set_current_state(TASK_INTERRUPTIBLE);
-	schedule();
+	if (serial_ring_count(&serial_tx_ring) == 0 && sending_task_active && !kthread_should_stop())
+	  schedule();
+	__set_current_state(TASK_RUNNING);
 	SERIAL_DEBUG_FLAG_OFF(SERIAL_FLAG_SND_READ_BLOCKED);
       }
     }
@@ -3674,7 +5256,7 @@ int serial_recv_task_running=0;
 
 int init_serial(u32 bauds)
 {
-  mavlinkserhb_initialize(bauds);
+  hypbackend->serial_initialize(bauds);
 
   /* if (!mavlinkserhb_activatehbhyptask(300 * HYPMTSCHEDULER_TIME_1USEC, 300 * HYPMTSCHEDULER_TIME_1USEC, 10)){ */
   /*   printk("ZSRM.init_serial(): error starting serial hyptask\n"); */
@@ -3731,7 +5313,7 @@ int receive(int rid, u8 *buffer, int buf_len, unsigned long *flags)
 
     // free semaphores and re-enable interrupts
     // enable interrupts
-    spin_unlock_irqrestore(&zsrmlock, *flags);
+    zsrm_unlock(*flags);
 
     // enable other syscalls
     up(&zsrmsem);
@@ -3780,37 +5362,95 @@ static ssize_t zsrm_read(struct file *filp,	/* see include/linux/fs.h   */
 			   size_t length,	/* length of the buffer     */
 			   loff_t * offset)
 {
+  unsigned long flags;
   int transfer_size;
-  int i;
+  int cpu;
+  int n;
+  struct trace_rec_t recs[32];
 
-  printk(KERN_INFO "ZSRMV: dumptrace: trace_index=%u\n", trace_index);
+  printk(KERN_INFO "ZSRMV: dumptrace: trace size=%lu\n", trace_size());
 
-  //zero-initialize debug_log
-  memset(&debug_log, 0, sizeof(debug_log));
+  // Copy the hypervisor log into the zsrm trace log. The accounting of
+  // the reserves is updated too, and read by budget enforcement under
+  // zsrmlock
+  spin_lock_irqsave(&zsrmlock,flags);
+  prevlocker = ZSV_CALL;
+  n = ingest_hyp_debug_log();
+  zsrm_unlock(flags);
 
-  // Copy the hypervisor log into the zsrm trace log
-  if(!hypmtscheduler_dumpdebuglog(&debug_log, &debug_log_buffer_index)){
+  if(n < 0){
     printk(KERN_INFO "ZSRMV: dumpdebuglog hypercall API failed\n");
   } else {
-    printk(KERN_INFO "ZSRMV: dumpdebuglog: total entries=%u\n", debug_log_buffer_index);
-	for (i = 0; i< debug_log_buffer_index; i++){
-      add_trace_record(debug_log[i].hyptask_id, debug_log[i].timestamp, debug_log[i].event_type);
-    }
+    printk(KERN_INFO "ZSRMV: dumpdebuglog: total entries=%d\n", n);
+  }
+
+  printk(KERN_INFO "ZSRMV: dumptrace: trace size=%lu\n", trace_size());
+
+  // a zero-length read only imports the hypervisor log (used by
+  // consumers of the mmap'd trace, see zsv_trace_sync())
+
+  // consume the rings one CPU after the other (records are in time
+  // order within each CPU) in batches that fit in the stack
+  transfer_size = 0;
+  for_each_possible_cpu(cpu){
+    do {
+      n = 0;
+      while (n < 32 && transfer_size + (n+1) * sizeof(struct trace_rec_t) <= length &&
+	     trace_ring_consume(&trace_rings[cpu], &recs[n]))
+	n++;
+      if (n > 0){
+	if (copy_to_user(buffer + transfer_size, recs, n * sizeof(struct trace_rec_t))){
+	  printk(KERN_WARNING "ZSRMV: error copying trace to user space\n");
+	  return -EFAULT;
+	}
+	transfer_size += n * sizeof(struct trace_rec_t);
+      }
+    } while (n == 32);
   }
 
-  printk(KERN_INFO "ZSRMV: dumptrace: trace_index=%u\n", trace_index);
+  return transfer_size;
+}
+
+/*
+ * The device is readable when the trace holds at least trace_watermark
+ * records. Commands (write()) never block.
+ */
+static unsigned int zsrm_poll(struct file *filp, poll_table *wait)
+{
+  unsigned int mask = POLLOUT | POLLWRNORM;
+
+  poll_wait(filp, &trace_wait_queue, wait);
 
-  transfer_size = (length >= (trace_index * sizeof(struct trace_rec_t))) ?
-    (trace_index * sizeof(struct trace_rec_t)) :
-    (length / sizeof(struct trace_rec_t)) * sizeof(struct trace_rec_t) ;
+  // pairs with the check in add_trace_record()
+  WRITE_ONCE(trace_waiters_pending, 1);
+  smp_mb();
 
-  if (copy_to_user(buffer, trace_table, transfer_size)<0){
-      printk(KERN_WARNING "ZSRMV: error copying trace_table to user space\n");
+  if (trace_size() < READ_ONCE(trace_watermark)){
+    // a record published on another CPU before it could see the flag
+    // does not wake this reader: re-check once those CPUs are past it
+    smp_call_function(trace_poll_sync, NULL, 1);
+    smp_mb();
   }
 
-  trace_index = 0;
+  if (trace_size() >= READ_ONCE(trace_watermark))
+    mask |= POLLIN | POLLRDNORM;
 
-  return transfer_size;
+  return mask;
+}
+
+/*
+ * Map the trace (control page followed by the per-CPU rings) so user
+ * space can consume it in place (see zsv_trace_map() in libzsv).
+ */
+static int zsrm_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+  if (trace_area == NULL)
+    return -ENODEV;
+
+  if (vma->vm_pgoff != 0 || (vma->vm_end - vma->vm_start) > trace_area_size)
+    return -EINVAL;
+
+  return remap_vmalloc_range(vma, trace_area, 0);
 }
 
 int valid_rid(int rid)
@@ -3835,11 +5475,20 @@ static ssize_t zsrm_write
   //int err;
   int need_reschedule=0;
   int ret = 0;
+  int created_hyptask = 0;
   struct api_call call;
   unsigned long flags;
   unsigned long long wcet;
   unsigned long long Z;
 
+  // clients built against an older struct api_call write fewer bytes:
+  // the fields they do not know about read as zero
+  if (count > sizeof(call)){
+    printk(KERN_WARNING "ZSRMMV: call of %zu bytes larger than struct api_call (%zu).\n", count, sizeof(call));
+    return -EINVAL;
+  }
+  memset(&call, 0, sizeof(call));
+
   /* copy data to kernel buffer. */
   if (copy_from_user(&call, buf, count)) {
     printk(KERN_WARNING "ZSRMMV: failed to copy data.\n");
@@ -3852,6 +5501,26 @@ static ssize_t zsrm_write
     return ret;
   }
 
+  // the filter update patches code so it runs without zsrmlock
+  if (call.cmd == SET_TRACE_FILTER){
+    ret = set_trace_filter(&call);
+    up(&zsrmsem);
+    return ret;
+  }
+
+#ifndef __ZSV_SECURE_TASK_BOOTSTRAP__
+  // the hypercalls that create the hyptask of an attach (and start its
+  // first guest job) run before interrupts are disabled. zsrmsem keeps
+  // other calls on the reserve out. The task is resolved first so an
+  // attach to a missing pid does not leave a hyptask behind
+  if (call.cmd == ATTACH_RSV && active_rid(call.rid) && call.pid > 0 &&
+      !reserve_table[call.rid].hypertask_active &&
+      gettask(call.pid, task_active_pid_ns(current)) != NULL){
+    create_hypertask(call.rid);
+    created_hyptask = reserve_table[call.rid].hypertask_active;
+  }
+#endif
+
   // disable interrupts to avoid concurrent interrupts
   spin_lock_irqsave(&zsrmlock,flags);
 
@@ -3914,7 +5583,20 @@ static ssize_t zsrm_write
     }
     break;
   case GET_TRACE_SIZE:
-    ret = trace_index;
+    ret = trace_size();
+    need_reschedule = 0;
+    break;
+  case SET_TRACE_WATERMARK:
+    // call.rid carries the number of records
+    if (call.rid <= 0 || call.rid > trace_rings[0].mask+1){
+      printk("ZSRMMV.write() ERROR invalid trace watermark(%d)\n",call.rid);
+      ret = -1;
+    } else {
+      WRITE_ONCE(trace_watermark, call.rid);
+      // the new watermark may already be reached
+      wake_up_interruptible(&trace_wait_queue);
+      ret = 0;
+    }
     need_reschedule = 0;
     break;
   case WAIT_PERIOD:
@@ -3978,6 +5660,7 @@ static ssize_t zsrm_write
       reserve_table[ret].zsinstant_ns = (call.zsinstant_sec * 1000000000L)+call.zsinstant_nsec;
       reserve_table[ret].hyp_enforcer_instant_ns = (call.hyp_enforcer_sec * 1000000000L) + call.hyp_enforcer_nsec;
       reserve_table[ret].hyp_enforcer_instant_ticks = ns2ticks(reserve_table[ret].hyp_enforcer_instant_ns);
+      reserve_table[ret].timer_slack_ns = (call.timer_slack_nsec > 0) ? call.timer_slack_nsec : 0L;
 
       // verify if zero slack instant is the same as period set it to twice its value to ensure that it does not
       // have the possibility of triggering before the end of period (effectively disabling it).
@@ -4050,6 +5733,12 @@ static ssize_t zsrm_write
 	need_reschedule=0;
 #else
 	ret = attach_reserve(call.rid,call.pid);
+	if (ret < 0 && created_hyptask){
+	  // the task exited after the hyptask was created
+	  hyp_cmdq_push(call.rid, UAPP_HYPMTSCHEDULER_UHCALL_DELETEHYPTASK);
+	  reserve_table[call.rid].hypertask_active=0;
+	  reserve_table[call.rid].hyp_cmd_last=0;
+	}
 #endif
 	need_reschedule=1;
       }
@@ -4106,7 +5795,7 @@ static ssize_t zsrm_write
 
 
   // enable interrupts
-  spin_unlock_irqrestore(&zsrmlock,flags);
+  zsrm_unlock(flags);
 
   // allow other syscalls
   // MOVED to after checking for need_reschedule to
@@ -4157,6 +5846,7 @@ void print_overhead_stats(void)
   unsigned long long avg_blocked_arrival_ns=0L;
   unsigned long long avg_departure_ns = 0L;
   unsigned long long avg_hypercall_ns = 0L;
+  unsigned long long avg_deferral_ns = 0L;
 
   if (num_hypercalls >0){
     avg_hypercall_ns = DIV(cumm_hypercall_ticks, num_hypercalls);
@@ -4198,6 +5888,11 @@ void print_overhead_stats(void)
     avg_departure_ns = ticks2ns1(avg_departure_ns);
   }
 
+  if (num_processed_deferrals >0){
+    avg_deferral_ns = DIV(cumm_deferral_ticks,num_processed_deferrals);
+    avg_deferral_ns = ticks2ns1(avg_deferral_ns);
+  }
+
   printk("zsrmv *** OVERHEAD STATS *** \n");
   printk("avg hypercall ns: %llu \t wc hypercall ns: %llu \t num hypercalls: %llu \n",
 	 avg_hypercall_ns, ticks2ns1(wc_hypercall_ticks), num_hypercalls);
@@ -4213,59 +5908,98 @@ void print_overhead_stats(void)
 	 avg_blocked_arrival_ns, num_blocked_arrivals);
   printk("avg departure ns: %llu \t wc departure ns: %llu \t num departures: %llu\n",
 	 avg_departure_ns, ticks2ns1(wc_departure_ticks), num_departures);
+  printk("timer contentions: %llu \t deferred timer events: %llu \t dropped timer events: %llu\n",
+	 (unsigned long long) atomic64_read(&num_timer_contentions),
+	 (unsigned long long) atomic64_read(&num_timer_deferrals),
+	 (unsigned long long) atomic64_read(&num_timer_drops));
+  printk("avg deferral ns: %llu \t wc deferral ns: %llu \t num processed deferrals: %llu\n",
+	 avg_deferral_ns, ticks2ns1(wc_deferral_ticks), num_processed_deferrals);
+  printk("hypervisor-driven releases: %llu\n", num_hyp_releases);
+  printk("hyptask command batches: %llu \t batched commands: %llu \t queue overflows: %llu\n",
+	 num_hyp_batches, num_hyp_batched_cmds, num_hyp_cmd_overflows);
   printk("zsrmv *** END OVERHEAD STATS *** \n");
 }
 
 static struct proc_dir_entry *proc_file = NULL;
 static struct file_operations proc_fops;
 
-/* dummy function. */
-static int proc_open(struct inode *inode, struct file *filp)
-{
-  return 0;
-}
-
-/* dummy function. */
-static int proc_release(struct inode *inode, struct file *filp)
-{
-  return 0;
-}
-
-static ssize_t proc_read(struct file *filp,	/* see include/linux/fs.h   */
-			   char *buffer,	/* buffer to fill with data */
-			   size_t length,	/* length of the buffer     */
-			   loff_t * offset)
+/*
+ * The /proc/zsrmv report (seq_file grows the buffer so the report is
+ * never cut short)
+ */
+static int proc_show(struct seq_file *m, void *v)
 {
-    int len;
-    static int eof=0;
-
-    if (!eof){
-      len = snprintf(buffer,length,"Receiver:%s \nSender:%s \nHWR RCV:%s \nHWR SND: %s \nRecv buffer: %s readIdx(%d) writeIdx(%d)\nTrans buffer: %s readIdx(%d) writeIdx(%d)\n#errors: %d\nLast Non-Zero Receive Count: %d\nNum Zero-Receives count:%lld\nLast receive count:%d\nLargest read count: %d\nMax sleep:%lld\n",
-		     ((serial_debug_flags & SERIAL_FLAG_RCV_READ_BLOCKED)? "BLOCKED" : "RUNNING"),
-		     ((serial_debug_flags & SERIAL_FLAG_SND_READ_BLOCKED)? "BLOCKED" : "RUNNING"),
-		     ((serial_is_reception_stopped())? "STOPPED" : "FREE"),
-		     ((serial_debug_flags & SERIAL_FLAG_HWR_SND_BLOCKED)? "STOPPED" : "FREE"),
-		     ((serial_receiving_writing_index == serial_receiving_reading_index)? "EMPTY" : "DATA"),
-		     serial_receiving_reading_index,
-		     serial_receiving_writing_index,
-		     ((serial_sending_writing_index == serial_sending_reading_index)? "EMPTY" : "DATA"),
-		     serial_sending_reading_index,
-		     serial_sending_writing_index,
-		     serial_receiving_error_count,
-		     serial_debug_last_non_zero_receive_count,
-		     serial_debug_num_zero_receive_counts,
-		     serial_debug_last_receive_count,
-		     serial_debug_largest_read_count,
-		     ticks2ns1(serial_debug_max_sleep_ticks)
-		    );
+    int cpu;
+    int rid;
+
+    seq_printf(m,"Receiver:%s \nSender:%s \nHWR RCV:%s \nHWR SND: %s \nRecv buffer: %s readIdx(%d) writeIdx(%d)\nTrans buffer: %s readIdx(%d) writeIdx(%d)\n#errors: %d\nLast Non-Zero Receive Count: %d\nNum Zero-Receives count:%lld\nLast receive count:%d\nLargest read count: %d\nMax sleep:%lld\nTimer contentions: %llu\nDeferred timer events: %llu\nDropped timer events: %llu\nAvg deferral ns: %llu\nWC deferral ns: %llu\n",
+	       ((serial_debug_flags & SERIAL_FLAG_RCV_READ_BLOCKED)? "BLOCKED" : "RUNNING"),
+	       ((serial_debug_flags & SERIAL_FLAG_SND_READ_BLOCKED)? "BLOCKED" : "RUNNING"),
+	       ((serial_is_reception_stopped())? "STOPPED" : "FREE"),
+	       ((serial_debug_flags & SERIAL_FLAG_HWR_SND_BLOCKED)? "STOPPED" : "FREE"),
+	       ((serial_ring_count(&serial_rx_ring) == 0)? "EMPTY" : "DATA"),
+	       serial_rx_ring.tail & serial_rx_ring.mask,
+	       serial_rx_ring.head & serial_rx_ring.mask,
+	       ((serial_ring_count(&serial_tx_ring) == 0)? "EMPTY" : "DATA"),
+	       serial_tx_ring.tail & serial_tx_ring.mask,
+	       serial_tx_ring.head & serial_tx_ring.mask,
+	       serial_receiving_error_count,
+	       serial_debug_last_non_zero_receive_count,
+	       serial_debug_num_zero_receive_counts,
+	       serial_debug_last_receive_count,
+	       serial_debug_largest_read_count,
+	       ticks2ns1(serial_debug_max_sleep_ticks),
+	       (unsigned long long) atomic64_read(&num_timer_contentions),
+	       (unsigned long long) atomic64_read(&num_timer_deferrals),
+	       (unsigned long long) atomic64_read(&num_timer_drops),
+	       (num_processed_deferrals > 0 ? ticks2ns1(DIV(cumm_deferral_ticks,num_processed_deferrals)) : 0L),
+	       ticks2ns1(wc_deferral_ticks)
+	       );
+    for_each_possible_cpu(cpu){
+      seq_printf(m, "Trace cpu%d: %u records %u lost\n",
+		 cpu,
+		 READ_ONCE(trace_rings[cpu].ctl->head) - READ_ONCE(trace_rings[cpu].ctl->tail),
+		 trace_rings[cpu].ctl->lost);
+    }
+    seq_printf(m, "Trace filter: %s events(0x%llx)\n",
+	       (static_branch_likely(&trace_enabled_key) ?
+		(static_branch_unlikely(&trace_filter_key) ? "on" : "off") : "trace disabled"),
+	       trace_filter.event_mask);
+    if (hyp_event_ring_area != NULL){
+      seq_printf(m, "Hyp event ring: %llu entries %u dropped\n",
+		 num_hyp_ring_entries, READ_ONCE(hyp_event_ring_area->dropped));
     } else {
-      // send eof
-      len = 0 ;
+      seq_printf(m, "Hyp event ring: off (dumpdebuglog)\n");
     }
+    seq_printf(m, "Serial rings: rx size(%u) high(%u) dropped(%llu) tx size(%u) high(%u) dropped(%llu)\n",
+	       serial_rx_ring.size, serial_rx_ring.high_watermark, serial_rx_ring.dropped,
+	       serial_tx_ring.size, serial_tx_ring.high_watermark, serial_tx_ring.dropped);
+    seq_printf(m, "Serial tx: %s sends(%llu) bytes(%llu) stalls(%llu) errors(%llu)\n",
+	       (serial_tx_zero_copy_active ? "zero-copy" : "copy"),
+	       num_serial_tx_spans,
+	       num_serial_tx_bytes,
+	       num_serial_tx_stalls,
+	       num_serial_tx_errors);
+    seq_printf(m, "Serial rx: %s poll(%d us) wakeups(%llu) empty(%llu) irqs(%llu) avg latency ns(%llu) wc latency ns(%llu)\n",
+	       (serial_rx_irq_active ? "irq" : "polling"),
+	       serial_rx_poll_us,
+	       num_serial_rx_wakeups,
+	       num_serial_rx_empty_wakeups,
+	       num_serial_rx_irqs,
+	       (num_serial_rx_irq_wakeups > 0 ? ticks2ns1(DIV(cumm_serial_rx_latency_ticks,num_serial_rx_irq_wakeups)) : 0L),
+	       ticks2ns1(wc_serial_rx_latency_ticks));
+    for (rid=0; rid<MAX_RESERVES; rid++){
+      if (reserve_table[rid].hyp_cmds_issued > 0 || reserve_table[rid].hyp_cmds_saved > 0){
+	seq_printf(m, "Hyptask rid(%d): %llu job commands issued %llu saved\n",
+		   rid, reserve_table[rid].hyp_cmds_issued, reserve_table[rid].hyp_cmds_saved);
+      }
+    }
+    return 0;
+}
 
-    eof = 1-eof;
-
-    return len;
+static int proc_open(struct inode *inode, struct file *filp)
+{
+  return single_open(filp, proc_show, NULL);
 }
 
 static ssize_t proc_write (struct file *file, const char *buf, size_t count, loff_t *offset)
@@ -4301,8 +6035,9 @@ static int __init zsrm_init(void)
 
   proc_fops.owner = THIS_MODULE;
   proc_fops.open = proc_open;
-  proc_fops.release = proc_release;
-  proc_fops.read = proc_read;
+  proc_fops.release = single_release;
+  proc_fops.read = seq_read;
+  proc_fops.llseek = seq_lseek;
   proc_fops.write = proc_write;
   proc_fops.unlocked_ioctl = proc_ioctl;
 
@@ -4319,13 +6054,46 @@ static int __init zsrm_init(void)
   // initialize semaphore
   sema_init(&zsrmsem,1); // binary - initially unlocked
 
-  // serial buffer semaphore
-  // binary -- initially unlocked
-  sema_init(&serial_buffer_sem,1);
+#ifdef CONFIG_ARM
+  if (!strcmp(hyp_backend, hyp_backend_xmhf.name))
+    hypbackend = &hyp_backend_xmhf;
+#endif
+  if (!strcmp(hyp_backend, hyp_backend_sw.name))
+    hypbackend = &hyp_backend_sw;
+
+  if (hypbackend == NULL || !hypbackend->init()){
+    printk(KERN_WARNING "ZSRMMV: could not initialize hypervisor backend(%s).\n", hyp_backend);
+    if (proc_file != NULL){
+      proc_remove(proc_file);
+    }
+    return -ENOMEM;
+  }
+
+  if (init_trace_rings() < 0){
+    free_trace_rings();
+    hypbackend->exit();
+    if (proc_file != NULL){
+      proc_remove(proc_file);
+    }
+    return -ENOMEM;
+  }
 
-  sema_init(&serial_sending_buffer_sem,1);
+  if (init_serial_rings() < 0){
+    free_serial_rings();
+    free_trace_rings();
+    hypbackend->exit();
+    if (proc_file != NULL){
+      proc_remove(proc_file);
+    }
+    return -ENOMEM;
+  }
 
   init();
+  init_zs_timerq();
+  init_pending_events();
+  init_hyp_release();
+  init_hyp_event_ring();
+  init_serial_tx_buffer();
   printk(KERN_INFO "ZSRMMV: HELLO!\n");
 
   /* get the device number of a char device. */
@@ -4354,6 +6122,8 @@ static int __init zsrm_init(void)
   zsrm_fops.release = zsrm_release;
   zsrm_fops.read = zsrm_read;
   zsrm_fops.write = zsrm_write;
+  zsrm_fops.mmap = zsrm_mmap;
+  zsrm_fops.poll = zsrm_poll;
 
   //#if LINUX_KERNEL_MINOR_VERSION < 37
   //zsrm_fops.ioctl = zsrm_ioctl;
@@ -4433,6 +6203,8 @@ static int __init zsrm_init(void)
 
   kthread_bind(serial_recv_task, 0);
 
+  init_serial_rx_irq();
+
   if (serial_recv_task){
     wake_up_process(serial_recv_task);
     serial_timer_prev_timestamp_ticks = get_now_ticks();
@@ -4463,10 +6235,13 @@ static int __init zsrm_init(void)
     wake_up_process(serial_sender_task);
   }
 
+#ifdef CONFIG_ARM
   init_cputsc();
+#endif
 
   //hypmtscheduler_inittsc();
 
+  init_timebase();
   setup_ticksclock();
 
   /* start_tick = sysreg_read_cntpct(); */
@@ -4498,7 +6273,14 @@ static void __exit zsrm_exit(void)
   activate_top = -1;
   kthread_stop(active_task);
 
+  exit_hyp_release();
+  cancel_zs_timerq();
+  exit_hyp_event_ring();
+  irq_work_sync(&zs_pending_work);
+  irq_work_sync(&trace_wakeup_work);
+
 #ifdef  __START_SERIAL_RECEIVER_TASK__
+  exit_serial_rx_irq();
   wake_up_process(serial_recv_task);
   kthread_stop(serial_recv_task);
 
@@ -4510,6 +6292,7 @@ static void __exit zsrm_exit(void)
   wake_up_interruptible(&serial_write_wait_queue);
   wake_up_process(serial_sender_task);
   kthread_stop(serial_sender_task);
+  exit_serial_tx_buffer();
 
 
   /* if (serial_recv_task_running){ */
@@ -4521,13 +6304,22 @@ static void __exit zsrm_exit(void)
 
   print_overhead_stats();
 
+#ifdef CONFIG_ARM
   end_tick = sysreg_read_cntpct(); //rdtsc64();
   printk("ZSRMV: cycle counter test start(%llu) end(%llu) count=%llu\n",start_tick, end_tick, (end_tick-start_tick));
+#endif
 
   printk(KERN_INFO "ZSRMMV: GOODBYE!\n");
 
   zsrm_cleanup_module();
 
+  free_trace_rings();
+  free_serial_rings();
+
+  // issue the commands still queued, then tear down after the last hypercall
+  hyp_cmdq_flush();
+  hypbackend->exit();
+
 #ifdef __SERIAL_HARDWARE_CONTROL_FLOW__
   gpio_free(cts_gpio_pin);
   gpio_free(GPIO_RTS);
@@ -32,6 +32,16 @@ struct zs_timer{
 #endif
   struct zs_timer *next;
 
+  // bumped on every arm and cancel so that an expiration deferred
+  // before them is discarded (see zs_process_pending_events())
+  unsigned int arm_generation;
+
+  // zero-slack timer queue bookkeeping (timerq_index == -1 when not queued)
+  int timerq_index;
+  int timerq_cpu;
+  unsigned long long timerq_expiration_ns;
+  unsigned long long timerq_slack_ns;
+
 #ifdef STAC_FRAMAC_STUBS
   //-- ghost variable to indicate whether the timer is armed and the
   //-- time (relative to point of arming) when it will go off
@@ -51,11 +61,25 @@ struct reserve {
   pid_t  pid;
   int rid;
   unsigned long long first_job_activation_ns;
+  unsigned long long current_job_release_ns; // nominal (drift-free) release of the current job
   unsigned long long job_activation_count;
   unsigned long long current_job_activation_ticks;
   unsigned long long current_job_deadline_ticks;
   int job_completed;
   unsigned long long current_job_hypertasks_preemption_ticks;
+  // hyptask executions ingested from the hypervisor log that started
+  // after hyp_preemption_job_ticks (the activation of the current job)
+  unsigned long long hyp_preemption_ticks;
+  unsigned long long hyp_preemption_job_ticks;
+  // last CREATEHYPTASK_BEFORE or HYPTASKEXEC_BEFORE of the hyptask (0: none)
+  unsigned long long hyp_last_start_ticks;
+  int hyp_last_start_event;
+  // guest-side cache of the hyptask state (see hyp_job_cmd()): last
+  // job-path command queued and the activation of the job it was for
+  int hyp_cmd_last;
+  unsigned long long hyp_cmd_last_job_ticks;
+  unsigned long long hyp_cmds_issued;
+  unsigned long long hyp_cmds_saved;
   unsigned long long start_ns;
   unsigned long long stop_ns;
   unsigned long long current_exectime_ns;
@@ -96,12 +120,17 @@ struct reserve {
   unsigned long long zsinstant_ns;
   unsigned long long period_ns;
   unsigned long long period_ticks;
+  // slack allowed on the expiration of the period and zero-slack timers
+  // to let the kernel coalesce them. Accounted as release jitter.
+  unsigned long long timer_slack_ns;
   struct timespec execution_time;
   struct timespec nominal_execution_time;
   int has_zsenforcement;
   int hypertask_active;
   int has_hyptask;
   uint32_t hyptask_handle; // u32
+  int hyp_driven_release;      // releases come from the hypervisor doorbell, no period hrtimer
+  uint32_t hyp_release_count;  // last doorbell release count consumed
   int priority;
   int criticality;
   int in_critical_mode;
@@ -0,0 +1,169 @@
+/*
+Mixed-Trust Kernel Module Scheduler
+Copyright 2020 Carnegie Mellon University and Hyoseung Kim.
+NO WARRANTY. THIS CARNEGIE MELLON UNIVERSITY AND SOFTWARE ENGINEERING INSTITUTE MATERIAL IS FURNISHED ON AN "AS-IS" BASIS. CARNEGIE MELLON UNIVERSITY MAKES NO WARRANTIES OF ANY KIND, EITHER EXPRESSED OR IMPLIED, AS TO ANY MATTER INCLUDING, BUT NOT LIMITED TO, WARRANTY OF FITNESS FOR PURPOSE OR MERCHANTABILITY, EXCLUSIVITY, OR RESULTS OBTAINED FROM USE OF THE MATERIAL. CARNEGIE MELLON UNIVERSITY DOES NOT MAKE ANY WARRANTY OF ANY KIND WITH RESPECT TO FREEDOM FROM PATENT, TRADEMARK, OR COPYRIGHT INFRINGEMENT.
+Released under a BSD (SEI)-style license, please see license.txt or contact permission@sei.cmu.edu for full terms.
+[DISTRIBUTION STATEMENT A] This material has been approved for public release and unlimited distribution.  Please see Copyright notice for non-US Government use and distribution.
+Carnegie Mellon® is registered in the U.S. Patent and Trademark Office by Carnegie Mellon University.
+DM20-0619
+*/
+
+/*
+ * Linux tracepoints of the scheduler (trace-cmd record -e zsrmv).
+ * There is one event per TRACE_EVENT_* type of zsrmvapi.h and one
+ * per DEBUG_LOG_EVTTYPE_* type of the hypervisor log (zsrmv_hyp_other
+ * for any other type). Timestamps are in counter ticks like the zsrmv
+ * trace. Hypervisor events are emitted when their log is imported so
+ * their ftrace time is the import time and the hypervisor time is in
+ * the timestamp field.
+ *
+ * Only zsrmv.c includes this file (after zsrmv.h).
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM zsrmv
+
+#if !defined(_ZSRMV_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define _ZSRMV_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+DECLARE_EVENT_CLASS(zsrmv_sched_event,
+
+	TP_PROTO(struct reserve *rsv, int rid, unsigned long long ts),
+
+	TP_ARGS(rsv, rid, ts),
+
+	TP_STRUCT__entry(
+		__field(int, rid)
+		__field(pid_t, pid)
+		__field(int, criticality)
+		__field(unsigned long long, budget_ticks)
+		__field(unsigned long long, exectime_ticks)
+		__field(unsigned long long, release_ticks)
+		__field(unsigned long long, timestamp)
+	),
+
+	TP_fast_assign(
+		__entry->rid = rid;
+		__entry->pid = rsv ? rsv->pid : -1;
+		__entry->criticality = rsv ? rsv->criticality : 0;
+		__entry->budget_ticks = rsv ? rsv->exectime_ticks : 0;
+		__entry->exectime_ticks = rsv ? rsv->current_exectime_ticks : 0;
+		__entry->release_ticks = rsv ? rsv->current_job_activation_ticks : 0;
+		__entry->timestamp = ts;
+	),
+
+	TP_printk("rid=%d pid=%d crit=%d budget=%llu exec=%llu release=%llu ts=%llu",
+		  __entry->rid, __entry->pid, __entry->criticality,
+		  __entry->budget_ticks, __entry->exectime_ticks,
+		  __entry->release_ticks, __entry->timestamp)
+);
+
+#define DEFINE_ZSRMV_SCHED_EVENT(name)					\
+	DEFINE_EVENT(zsrmv_sched_event, zsrmv_##name,			\
+		     TP_PROTO(struct reserve *rsv, int rid, unsigned long long ts), \
+		     TP_ARGS(rsv, rid, ts))
+
+DEFINE_ZSRMV_SCHED_EVENT(wait_period);
+DEFINE_ZSRMV_SCHED_EVENT(start_period);
+DEFINE_ZSRMV_SCHED_EVENT(preempted);
+DEFINE_ZSRMV_SCHED_EVENT(resumed);
+DEFINE_ZSRMV_SCHED_EVENT(budget_enforced);
+DEFINE_ZSRMV_SCHED_EVENT(dont_wait_period);
+DEFINE_ZSRMV_SCHED_EVENT(idle);
+DEFINE_ZSRMV_SCHED_EVENT(end_period);
+DEFINE_ZSRMV_SCHED_EVENT(wait_release);
+DEFINE_ZSRMV_SCHED_EVENT(wait_release_blocked);
+DEFINE_ZSRMV_SCHED_EVENT(wait_release_not_blocked);
+DEFINE_ZSRMV_SCHED_EVENT(start_period_periodic_wait);
+DEFINE_ZSRMV_SCHED_EVENT(start_period_non_periodic_wait_wakeup);
+DEFINE_ZSRMV_SCHED_EVENT(start_period_non_periodic_wait_no_wakeup);
+DEFINE_ZSRMV_SCHED_EVENT(zero_slack);
+
+DECLARE_EVENT_CLASS(zsrmv_hyp_event,
+
+	TP_PROTO(u32 hyptask_id, u64 ts),
+
+	TP_ARGS(hyptask_id, ts),
+
+	TP_STRUCT__entry(
+		__field(u32, hyptask_id)
+		__field(u64, timestamp)
+	),
+
+	TP_fast_assign(
+		__entry->hyptask_id = hyptask_id;
+		__entry->timestamp = ts;
+	),
+
+	TP_printk("hyptask=%u ts=%llu", __entry->hyptask_id, __entry->timestamp)
+);
+
+#define DEFINE_ZSRMV_HYP_EVENT(name)					\
+	DEFINE_EVENT(zsrmv_hyp_event, zsrmv_hyp_##name,			\
+		     TP_PROTO(u32 hyptask_id, u64 ts),			\
+		     TP_ARGS(hyptask_id, ts))
+
+DEFINE_ZSRMV_HYP_EVENT(createhyptask_before);
+DEFINE_ZSRMV_HYP_EVENT(createhyptask_after);
+DEFINE_ZSRMV_HYP_EVENT(disablehyptask_before);
+DEFINE_ZSRMV_HYP_EVENT(disablehyptask_after);
+DEFINE_ZSRMV_HYP_EVENT(deletehyptask_before);
+DEFINE_ZSRMV_HYP_EVENT(deletehyptask_after);
+DEFINE_ZSRMV_HYP_EVENT(inittsc_before);
+DEFINE_ZSRMV_HYP_EVENT(inittsc_after);
+DEFINE_ZSRMV_HYP_EVENT(hyptaskexec_before);
+DEFINE_ZSRMV_HYP_EVENT(hyptaskexec_after);
+DEFINE_ZSRMV_HYP_EVENT(handlehcall_before);
+DEFINE_ZSRMV_HYP_EVENT(handlehcall_after);
+DEFINE_ZSRMV_HYP_EVENT(schedlogic_before);
+DEFINE_ZSRMV_HYP_EVENT(schedlogic_after);
+DEFINE_ZSRMV_HYP_EVENT(timerhandler_before);
+DEFINE_ZSRMV_HYP_EVENT(timerhandler_after_notimersexpired);
+DEFINE_ZSRMV_HYP_EVENT(timerhandler_after_timerexpiredinhyp);
+DEFINE_ZSRMV_HYP_EVENT(timerhandler_after_timerexpiredgotoschedlogic);
+DEFINE_ZSRMV_HYP_EVENT(phystimerprogram_timerhandler);
+DEFINE_ZSRMV_HYP_EVENT(phystimerprogram_undeclare);
+DEFINE_ZSRMV_HYP_EVENT(phystimerprogram_instantiateshortest);
+DEFINE_ZSRMV_HYP_EVENT(phystimerprogram_instantiateshorter);
+DEFINE_ZSRMV_HYP_EVENT(startguestjob_before);
+DEFINE_ZSRMV_HYP_EVENT(startguestjob_after);
+DEFINE_ZSRMV_HYP_EVENT(disablehyptask_invalid_start);
+DEFINE_ZSRMV_HYP_EVENT(first_period_param);
+DEFINE_ZSRMV_HYP_EVENT(regular_period_param);
+DEFINE_ZSRMV_HYP_EVENT(invalid_start_num_period_offset);
+
+/*
+ * Hypervisor log entries of a type without its own event (e.g. from a
+ * newer hypervisor) are still emitted with their raw type.
+ */
+TRACE_EVENT(zsrmv_hyp_other,
+
+	TP_PROTO(u32 hyptask_id, u64 ts, u32 event_type),
+
+	TP_ARGS(hyptask_id, ts, event_type),
+
+	TP_STRUCT__entry(
+		__field(u32, hyptask_id)
+		__field(u64, timestamp)
+		__field(u32, event_type)
+	),
+
+	TP_fast_assign(
+		__entry->hyptask_id = hyptask_id;
+		__entry->timestamp = ts;
+		__entry->event_type = event_type;
+	),
+
+	TP_printk("hyptask=%u ts=%llu type=%u", __entry->hyptask_id,
+		  __entry->timestamp, __entry->event_type)
+);
+
+#endif /* _ZSRMV_TRACE_H_ */
+
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE zsrmv_trace
+#include <trace/define_trace.h>
@@ -15,6 +15,8 @@ DM20-0619
 #include <unistd.h>
 #include <sys/syscall.h>
 #include <stdio.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #ifdef SYS_gettid
 #define gettid() syscall(SYS_gettid)
 #else
@@ -40,6 +42,8 @@ DM20-0619
 #define INIT_SERIAL 15
 #define RECV_SERIAL 16
 #define SIM_CRASH 17
+#define SET_TRACE_WATERMARK 18
+#define SET_TRACE_FILTER 19
 
 #define STRING_ZSV_CALL(c) ( c == WAIT_PERIOD ? "wait_period" : \
 			     c == CREATE_RSV  ? "create_rsv"  : \
@@ -51,6 +55,8 @@ DM20-0619
 			     c == GET_TRACE_SIZE ? "get_trace_size" :\
 			     c == END_PERIOD ? "end_period" : \
 			     c == WAIT_RELEASE ? "wait_release" : \
+			     c == SET_TRACE_WATERMARK ? "set_trace_watermark" : \
+			     c == SET_TRACE_FILTER ? "set_trace_filter" : \
 			     "unknown")
 #define ENF_NONE 0
 #define ENF_BUDGET 1
@@ -71,6 +77,7 @@ DM20-0619
 #define TRACE_EVENT_START_PERIOD_PERIODIC_WAIT 12
 #define TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_WAKEUP 13
 #define TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_NO_WAKEUP 14
+#define TRACE_EVENT_ZERO_SLACK 15
 
 #define STRING_TRACE_EVENT(e) ( e == TRACE_EVENT_WFNP ? "wait_period" : \
 				e == TRACE_EVENT_START_PERIOD ? "start_period": \
@@ -86,9 +93,24 @@ DM20-0619
 				e == TRACE_EVENT_START_PERIOD_PERIODIC_WAIT ? "start_period_periodic_wait" :\
 				e == TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_WAKEUP ? "start_period_non_periodic_wait_wakeup" :\
 				e == TRACE_EVENT_START_PERIOD_NON_PERIODIC_WAIT_NO_WAKEUP ? "start_period_non_periodic_wait_no_wakeup" :\
+				e == TRACE_EVENT_ZERO_SLACK ? "zero_slack" :\
 				"unknown" \
 				)
 
+// hypervisor log events imported into the trace (rid is the hyptask
+// id). Same values as DEBUG_LOG_EVTTYPE_* in hypmtscheduler.h
+#define ZSV_HYP_EVENT_BASE 50
+#define ZSV_HYP_EVENT_CREATEHYPTASK_BEFORE 50
+#define ZSV_HYP_EVENT_CREATEHYPTASK_AFTER 51
+#define ZSV_HYP_EVENT_DISABLEHYPTASK_BEFORE 52
+#define ZSV_HYP_EVENT_DISABLEHYPTASK_AFTER 53
+#define ZSV_HYP_EVENT_DELETEHYPTASK_BEFORE 54
+#define ZSV_HYP_EVENT_DELETEHYPTASK_AFTER 55
+#define ZSV_HYP_EVENT_INITTSC_BEFORE 56
+#define ZSV_HYP_EVENT_INITTSC_AFTER 57
+#define ZSV_HYP_EVENT_HYPTASKEXEC_BEFORE 58
+#define ZSV_HYP_EVENT_HYPTASKEXEC_AFTER 59
+
 //#define BUNDLE_RID_STOP(rid,stop) ((rid+1) *(stop ? -1 : 1))
 //#define EXTRACT_RID(b) ( b<0 ? (-1*b)-1 : b-1)
 //#define EXTRACT_STOP(b) (b<0)
@@ -104,6 +126,135 @@ struct trace_rec_t {
   int rid;
 };
 
+/*
+ * Layout of the trace mapping of /dev/zsrmmv0: the control pages with
+ * the state of the trace ring of each of the num_cpus CPUs followed by
+ * the records of the rings. head, tail and lost are free-running
+ * counters (the record with counter c is at index c & (size-1) of its
+ * ring). The kernel only advances head; both the kernel (when
+ * overwriting) and the consumer advance tail with compare-and-swap.
+ */
+#define ZSV_TRACE_VERSION 1
+
+struct zsv_trace_ring_ctl {
+  unsigned int head;
+  unsigned int tail;
+  unsigned int lost;
+  unsigned int size;    // records, power of two
+  unsigned int offset;  // bytes from the start of the mapping to the records
+  unsigned int reserved[3];
+};
+
+struct zsv_trace_ctl {
+  unsigned int version;
+  unsigned int num_cpus;
+  unsigned int map_size; // bytes of the whole mapping
+  unsigned int rec_size;
+  struct zsv_trace_ring_ctl ring[]; // num_cpus entries
+};
+
+/*
+ * Trace filter (SET_TRACE_FILTER): a record is kept if the bit of its
+ * event type is set in event_mask and the bit of its rid in rid_mask.
+ * Event types >= 64 and rids >= ZSV_TRACE_MAX_RIDS are always kept. An
+ * empty event_mask disables the trace.
+ */
+#define ZSV_TRACE_MAX_RIDS 128
+#define ZSV_TRACE_ALL_EVENTS (~0ULL)
+
+struct zsv_trace_filter {
+  unsigned long long event_mask;
+  unsigned int rid_mask[ZSV_TRACE_MAX_RIDS/32];
+};
+
+#define ZSV_TRACE_FILTER_ALL(f) memset((f), 0xff, sizeof(struct zsv_trace_filter))
+#define ZSV_TRACE_FILTER_NONE(f) memset((f), 0, sizeof(struct zsv_trace_filter))
+#define ZSV_TRACE_FILTER_SET_EVENT(f,e) ((f)->event_mask |= 1ULL << (e))
+#define ZSV_TRACE_FILTER_CLR_EVENT(f,e) ((f)->event_mask &= ~(1ULL << (e)))
+#define ZSV_TRACE_FILTER_SET_RID(f,rid) ((f)->rid_mask[(rid)/32] |= 1U << ((rid)%32))
+#define ZSV_TRACE_FILTER_CLR_RID(f,rid) ((f)->rid_mask[(rid)/32] &= ~(1U << ((rid)%32)))
+
+#ifndef __KERNEL__
+// user-space view of the trace mapping
+struct zsv_trace_map {
+  void *base;
+  struct zsv_trace_ctl *ctl;
+};
+
+/*
+ * Binary trace files (zsv_write_trace_binary()). The file starts with
+ * ZSV_TRACE_FILE_MAGIC and the format version (4 bytes each, little
+ * endian) followed by blocks of records of one CPU:
+ *
+ *   4-byte length of the rest of the block
+ *   varint cpu, varint number of records, 8-byte base timestamp
+ *   per record: varint zigzag(timestamp - previous timestamp)
+ *               varint (zigzag(rid) << 5) | event_type
+ *
+ * The previous timestamp of the first record is the base timestamp.
+ * Event types >= ZSV_TRACE_EVENT_ESCAPE store ZSV_TRACE_EVENT_ESCAPE
+ * followed by a varint with event_type - ZSV_TRACE_EVENT_ESCAPE.
+ * Typical records take 3-4 bytes instead of the 16 of trace_rec_t.
+ * The block length lets readers find the block boundaries without
+ * decoding the records (version 1 files have no block length).
+ */
+#define ZSV_TRACE_FILE_MAGIC 0x5456535a // "ZSVT"
+#define ZSV_TRACE_FILE_VERSION 2
+#define ZSV_TRACE_FILE_HEADER_BYTES 8
+#define ZSV_TRACE_BLOCK_HEADER_BYTES 4
+#define ZSV_TRACE_EVENT_BITS 5
+#define ZSV_TRACE_EVENT_ESCAPE ((1 << ZSV_TRACE_EVENT_BITS) - 1)
+#define ZSV_TRACE_BLOCK_RECORDS 4096
+// worst-case encoded size of a block of n records
+#define ZSV_TRACE_BLOCK_BYTES(n) (ZSV_TRACE_BLOCK_HEADER_BYTES + 2 * 10 + 8 + (n) * (3 * 10))
+
+// streaming decoder of binary trace files
+struct zsv_trace_decoder {
+  FILE *fid;
+  int version;
+  int cpu;
+  unsigned long remaining;
+  unsigned long long last_timestamp;
+};
+
+/*
+ * Background consumer of the trace (zsv_trace_stream()). The thread
+ * sleeps in poll() until the trace reaches the watermark, or for at
+ * most ZSV_TRACE_STREAM_TIMEOUT_MS to import the hypervisor log, and
+ * writes the records to outfd in text or binary format.
+ */
+#define ZSV_TRACE_STREAM_TIMEOUT_MS 1000
+
+struct zsv_trace_stream {
+  pthread_t thread;
+  int schedfd;
+  int outfd;
+  int binary;
+  atomic_int running; // cleared by zsv_trace_stream_stop()
+  long records;
+  long errors;
+};
+
+/*
+ * Export of the trace in the Chrome trace-event (JSON) format read by
+ * Perfetto and chrome://tracing: process 1 has a track per reserve with
+ * its jobs and their execution, process 2 a track per hyptask with its
+ * executions. Enforcements, zero-slack instants and hyptask
+ * creation/deletion are instant markers. Records must be in time order
+ * per reserve and per hyptask: a trace is only in time order within
+ * each CPU, so sort it with zsv_trace_sort() before exporting it.
+ */
+struct zsv_chrome_export {
+  FILE *out;
+  double ticks_per_us;
+  long events;
+  unsigned char job_open[ZSV_TRACE_MAX_RIDS];
+  unsigned char running[ZSV_TRACE_MAX_RIDS];
+  unsigned char hyp_running[ZSV_TRACE_MAX_RIDS];
+  unsigned char named[ZSV_TRACE_MAX_RIDS]; // track names emitted
+};
+#endif
+
 struct threaded_signal_handler_table_t {
   int rid;
   void (*zsv_user_enforcement_handler)(void *p, int);
@@ -132,6 +283,7 @@ struct api_call {
   unsigned long long *pwcet;
   void *buffer;
   int buf_len;
+  long timer_slack_nsec;
 };
 
 struct reserve_spec_t {
@@ -144,11 +296,13 @@ struct reserve_spec_t {
   long nominal_exec_sec;
   long nominal_exec_nsec;
   int criticality;
+  long timer_slack_nsec;
 };
 
 int zsv_is_admissible(struct reserve_spec_t *reserves_specs_table, int tablesize);
 int zsv_get_wcet_ns(int schedfd, int rid, unsigned long long *pwcet);
 int zsv_get_acet_ns(int schedfd, int rid, unsigned long long *pacet);
+int zsv_get_trace_size(int schedfd);
 void busy_timestamped(long millis, unsigned long long tsbuffer[], 
                       long bufsize, long *bufidx);
 int zsv_create_reserve(int schedfd, long period_sec, long period_nsec,
@@ -158,6 +312,13 @@ int zsv_create_reserve(int schedfd, long period_sec, long period_nsec,
 		       long nominal_exec_sec, long nominal_exec_nsec,
 		       int priority,
 		       int criticality);
+int zsv_create_reserve_with_slack(int schedfd, long period_sec, long period_nsec,
+				  long zsinstant_sec, long zsinstant_nsec,
+				  long hyp_enforcer_sec, long hyp_enforcer_nsec,
+				  long exec_sec, long exec_nsec,
+				  long nominal_exec_sec, long nominal_exec_nsec,
+				  int priority, int criticality,
+				  long timer_slack_nsec);
 int zsv_attach_reserve(int schedfd, int pid, int rid);
 int zsv_wait_period(int schedfd, int rid);
 int zsv_nowait_period(int schedfd, int rid);
@@ -181,5 +342,23 @@ int zsv_mtserial_init(int schedfd, int bauds);
 int zsv_simulate_crash(int schedfid);
 #ifndef __KERNEL__
 int zsv_write_trace(int schedfd, FILE *fid);
+int zsv_trace_sync(int schedfd);
+int zsv_trace_map(int schedfd, struct zsv_trace_map *map);
+int zsv_trace_unmap(struct zsv_trace_map *map);
+struct trace_rec_t *zsv_trace_peek(struct zsv_trace_map *map, int cpu, unsigned int *idx);
+int zsv_trace_consume(struct zsv_trace_map *map, int cpu, unsigned int idx);
+int zsv_trace_encode_block(int cpu, struct trace_rec_t *recs, int n, unsigned char *buf);
+int zsv_write_trace_binary(int schedfd, FILE *fid);
+int zsv_trace_decoder_open(struct zsv_trace_decoder *dec, FILE *fid);
+int zsv_trace_decoder_open_block(struct zsv_trace_decoder *dec, FILE *fid, int version);
+int zsv_trace_decode_next(struct zsv_trace_decoder *dec, struct trace_rec_t *rec, int *cpu);
+int zsv_trace_sort(struct trace_rec_t *recs, long n);
+int zsv_set_trace_watermark(int schedfd, int records);
+int zsv_set_trace_filter(int schedfd, struct zsv_trace_filter *filter);
+int zsv_trace_stream(struct zsv_trace_stream *stream, int schedfd, int outfd, int binary, int watermark);
+int zsv_trace_stream_stop(struct zsv_trace_stream *stream);
+int zsv_chrome_export_begin(struct zsv_chrome_export *exp, FILE *out, long long ticks_per_sec);
+int zsv_chrome_export_record(struct zsv_chrome_export *exp, struct trace_rec_t *rec);
+int zsv_chrome_export_end(struct zsv_chrome_export *exp);
 #endif
 #endif